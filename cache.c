@@ -0,0 +1,269 @@
+/*
+  cache.c
+
+  A content-addressed cache of output files, so that tables which
+  have not changed need not be compiled again, for tt2rom version 2.
+ */
+
+#include "cache.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COMMENT_CHAR '#'
+#define MIN_TEXT 256    /* initial size of the table text   */
+#define COPY_SIZE 32768 /* buffer size for copying files    */
+#define END_TEXT "%%\n" /* ends the text part of a manifest */
+#define MAX_NAME 256    /* longest file name in a manifest  */
+#define MASK32 0xFFFFFFFFUL
+
+/* Add a character to the text of an entry, growing it if need be */
+static int add_char(centry *ce, size_t *alloc, int c) {
+  if (ce->len == *alloc) {
+    char *tmp = realloc(ce->text, 2 * *alloc);
+
+    if (tmp == NULL) return 0;
+
+    ce->text = tmp;
+    *alloc *= 2;
+  }
+
+  ce->text[ce->len++] = c;
+  return 1;
+
+} /* end add_char() */
+
+/* Make the name of a file in the cache directory, or NULL if there is
+   no memory for it.  The caller must free it.
+ */
+static char *cache_path(centry *ce, char *name) {
+  char *path = malloc(strlen(ce->dir) + strlen(name) + 2);
+
+  if (path != NULL) sprintf(path, "%s/%s", ce->dir, name);
+
+  return path;
+
+} /* end cache_path() */
+
+static int copy_file(char *from, char *to) {
+  FILE *ifp, *ofp;
+  char *buf;
+  size_t len;
+  int ok = 1;
+
+  if ((buf = malloc(COPY_SIZE)) == NULL) return 0;
+
+  if ((ifp = fopen(from, "rb")) == NULL) {
+    free(buf);
+    return 0;
+  }
+
+  if ((ofp = fopen(to, "wb")) == NULL) {
+    fclose(ifp);
+    free(buf);
+    return 0;
+  }
+
+  while ((len = fread(buf, 1, COPY_SIZE, ifp)) > 0)
+    if (fwrite(buf, 1, len, ofp) != len) ok = 0;
+
+  if (ferror(ifp)) ok = 0;
+  if (fclose(ofp) != 0) ok = 0;
+
+  fclose(ifp);
+  free(buf);
+
+  return ok;
+
+} /* end copy_file() */
+
+/*
+  The key is two independent 32-bit hashes of the text, FNV-1a and
+  sdbm, written in hexadecimal.  Since the text itself is kept in the
+  manifest and compared on lookup, a collision costs only a miss.
+ */
+int cache_open(centry *ce, char *dir, char *settings, FILE *ifp) {
+  unsigned long fnv = 2166136261UL, sdbm = 0;
+  size_t ix, alloc = MIN_TEXT, start;
+  int c, skip = 0;
+
+  ce->dir = dir;
+  ce->len = 0;
+  ce->mfp = NULL;
+  ce->tag[0] = '\0';
+
+  if ((ce->text = malloc(alloc)) == NULL) return 0;
+
+  while (*settings)
+    if (!add_char(ce, &alloc, *settings++)) return 0;
+
+  /* Keep only what process_file() pays attention to */
+  start = ce->len;
+  while ((c = getc(ifp)) != EOF) {
+    if (c == '\n') {
+      if (ce->len > start && !add_char(ce, &alloc, '\n')) return 0;
+
+      start = ce->len;
+      skip = 0;
+    } else if (c == COMMENT_CHAR) {
+      skip = 1;
+    } else if (!skip && !isspace(c)) {
+      if (!add_char(ce, &alloc, c)) return 0;
+    }
+  }
+  if (ce->len > start && !add_char(ce, &alloc, '\n')) return 0;
+
+  rewind(ifp);
+
+  for (ix = 0; ix < ce->len; ix++) {
+    c = (unsigned char)ce->text[ix];
+
+    fnv = ((fnv ^ c) * 16777619UL) & MASK32;
+    sdbm = (c + (sdbm << 6) + (sdbm << 16) - sdbm) & MASK32;
+  }
+
+  sprintf(ce->key, "%08lx%08lx", fnv, sdbm);
+
+  return 1;
+
+} /* end cache_open() */
+
+int cache_fetch(centry *ce, char *tmpl) {
+  char name[MAX_NAME], *path, *oname, *buf;
+  FILE *mfp;
+  int num, nfiles = 0, ok;
+
+  if ((path = cache_path(ce, ce->key)) == NULL) return 0;
+
+  mfp = fopen(path, "rb");
+  free(path);
+  if (mfp == NULL) return 0;
+
+  /* The settings and table must be exactly the same */
+  if ((buf = malloc(ce->len + sizeof(END_TEXT))) == NULL) {
+    fclose(mfp);
+    return 0;
+  }
+
+  ok = fread(buf, 1, ce->len + strlen(END_TEXT), mfp) ==
+           ce->len + strlen(END_TEXT) &&
+       memcmp(buf, ce->text, ce->len) == 0 &&
+       memcmp(buf + ce->len, END_TEXT, strlen(END_TEXT)) == 0;
+  free(buf);
+
+  if (ok && (oname = malloc(strlen(tmpl) + 3 * sizeof(int) + 1)) != NULL) {
+    while (ok && fscanf(mfp, "%d %255s", &num, name) == 2) {
+      sprintf(oname, tmpl, num);
+
+      if ((path = cache_path(ce, name)) == NULL || !copy_file(path, oname))
+        ok = 0;
+      else
+        ++nfiles;
+
+      free(path);
+    }
+
+    free(oname);
+  }
+
+  fclose(mfp);
+
+  return ok ? nfiles : 0;
+
+} /* end cache_fetch() */
+
+/*
+  The new entry's files are given names no other entry uses, and the
+  manifest is written under a temporary name and renamed into place
+  last, so that a lookup never sees a half-finished entry.  Files of
+  an entry that is replaced are left behind; the cache directory may
+  be emptied at any time.
+ */
+int cache_begin(centry *ce) {
+  char name[2 * CACHE_KEYLEN + 2], *path;
+
+  sprintf(ce->tag, "%08lx%08lx",
+          ((unsigned long)time(NULL) ^ (unsigned long)ce) & MASK32,
+          (unsigned long)clock() & MASK32);
+
+  sprintf(name, "%s.%s", ce->key, ce->tag);
+  if ((path = cache_path(ce, name)) == NULL) return 0;
+
+  if ((ce->mfp = fopen(path, "wb")) != NULL) {
+    fwrite(ce->text, 1, ce->len, ce->mfp);
+    fputs(END_TEXT, ce->mfp);
+  }
+
+  free(path);
+
+  return ce->mfp != NULL;
+
+} /* end cache_begin() */
+
+int cache_add(centry *ce, int num, char *fname) {
+  char name[2 * CACHE_KEYLEN + 3 * sizeof(int) + 3], *path;
+  int ok;
+
+  if (ce->mfp == NULL) return 0;
+
+  sprintf(name, "%s.%s.%d", ce->key, ce->tag, num);
+  if ((path = cache_path(ce, name)) == NULL) return 0;
+
+  if ((ok = copy_file(fname, path)) != 0)
+    fprintf(ce->mfp, "%d %s\n", num, name);
+
+  free(path);
+
+  return ok;
+
+} /* end cache_add() */
+
+int cache_end(centry *ce) {
+  char name[2 * CACHE_KEYLEN + 2], *tpath, *path;
+  int ok;
+
+  if (ce->mfp == NULL) return 0;
+
+  ok = (fclose(ce->mfp) == 0);
+  ce->mfp = NULL;
+
+  sprintf(name, "%s.%s", ce->key, ce->tag);
+  tpath = cache_path(ce, name);
+  path = cache_path(ce, ce->key);
+
+  if (tpath == NULL || path == NULL) {
+    ok = 0;
+  } else if (!ok || rename(tpath, path) != 0) {
+    remove(tpath);
+    ok = 0;
+  }
+
+  free(tpath);
+  free(path);
+
+  return ok;
+
+} /* end cache_end() */
+
+void cache_close(centry *ce) {
+  char name[2 * CACHE_KEYLEN + 2], *path;
+
+  if (ce->mfp != NULL) {
+    fclose(ce->mfp);
+    ce->mfp = NULL;
+
+    sprintf(name, "%s.%s", ce->key, ce->tag);
+    if ((path = cache_path(ce, name)) != NULL) {
+      remove(path);
+      free(path);
+    }
+  }
+
+  free(ce->text);
+  ce->text = NULL;
+
+} /* end cache_close() */
+
+/* Here there be dragons */
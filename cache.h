@@ -0,0 +1,58 @@
+/*
+  cache.h
+
+  A content-addressed cache of output files, so that tables which
+  have not changed need not be compiled again, for tt2rom version 2.
+ */
+
+#ifndef _H_CACHE_
+#define _H_CACHE_
+
+#include <stdio.h>
+
+#define CACHE_KEYLEN 16 /* hex digits in a cache key */
+
+/* What is known about one table while it is looked up or stored.  An
+   entry is a manifest file named by the key, which holds the settings
+   and the normalised table it was made from, followed by the ROM
+   numbers and the names of the files holding their output.
+ */
+typedef struct {
+  char *dir;                  /* cache directory               */
+  char key[CACHE_KEYLEN + 1]; /* hash of settings and table    */
+  char *text;                 /* settings and normalised table */
+  size_t len;                 /* length of text                */
+  char tag[CACHE_KEYLEN + 1]; /* names the files being stored  */
+  FILE *mfp;                  /* manifest being stored         */
+} centry;
+
+/* Read the table from 'ifp', normalised by removing comments,
+   whitespace, and blank lines, and compute the key for it together
+   with the 'settings' string, which should name everything besides
+   the table that affects the output.  The input is rewound afterward.
+   Returns false if memory could not be had.
+ */
+int cache_open(centry *ce, char *dir, char *settings, FILE *ifp);
+
+/* Look up the entry for 'ce'.  If there is one, and its settings and
+   table are the same, copy its files to the names made from 'tmpl' by
+   substituting the ROM number, and return the number of files copied.
+   Returns 0 if there is no such entry, or it could not be copied.
+ */
+int cache_fetch(centry *ce, char *tmpl);
+
+/* Start storing a new entry for 'ce'.  Returns false if the cache
+   directory cannot be written.
+ */
+int cache_begin(centry *ce);
+
+/* Store output file 'fname' as ROM number 'num' of the new entry */
+int cache_add(centry *ce, int num, char *fname);
+
+/* Finish storing the new entry, replacing any old one */
+int cache_end(centry *ce);
+
+/* Release memory used by 'ce', abandoning any unfinished entry */
+void cache_close(centry *ce);
+
+#endif /* end _H_CACHE_ */
@@ -0,0 +1,919 @@
+/*
+  libtt2rom.c
+
+  Compiling truth tables into ROM images in memory, for programs that
+  embed tt2rom version 2.
+ */
+
+#include "libtt2rom.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "text.h"
+
+/* Allocate the ROM images for the layout of a table */
+static int alloc_roms(tt_table *tp);
+
+/* Release the ROM images of a table */
+static void free_roms(tt_table *tp);
+
+/* Save a compiled row, and pass it to the expander if there is one */
+static int keep_row(tt_table *tp, address base, address mask, byte *data,
+                    int line);
+
+/* Record an error, unless there already is one */
+static int set_error(tt_table *tp, int err);
+
+/* Which lane of its image the low byte of a ROM's word is kept in */
+#define LANE(T, N) \
+  (((T)->rom[N]->width > (T)->lay.wbytes[N]) ? (T)->lay.off[N] : 0)
+
+/* Which lane of its image holds byte 'K' of a ROM's word, counting in
+   the order the bytes are written
+ */
+#define BYTE_LANE(T, N, K) \
+  (LANE(T, N) + ((T)->opt.enc.big ? (T)->lay.wbytes[N] - 1 - (K) : (K)))
+
+#define HDR_SIZE 28     /* bytes in a compiled table's header */
+#define REC_FIXED 12    /* bytes in a record besides the data */
+#define SAVE_SIZE 4096  /* buffer size for tt_save()          */
+#define WINDOW_BITS 6   /* log2 of pages in a tt_stream() window */
+#define FNV_PRIME 16777619UL
+#define MASK32 0xFFFFFFFFUL
+
+void tt_defaults(tt_options *opt) {
+  opt->odcv = '1';
+  opt->fill = 0;
+  opt->interleave = 0;
+  opt->nthreads = 1;
+  opt->pipeline = 0;
+  opt->split = 0;
+  default_encoding(&opt->enc);
+  opt->pins = NULL;
+  opt->new_rom = NULL;
+  opt->rom_arg = NULL;
+
+} /* end tt_defaults() */
+
+void tt_begin(tt_table *tp, tt_options *opt) {
+  tp->opt = *opt;
+  tp->nroms = tp->abits = 0;
+  tp->rom = NULL;
+  tp->line = tp->eline = 0;
+  tp->err = TT_OK;
+  tp->wanted = tp->got = 0;
+  tp->lay.config = NULL;
+  tp->lay.names = NULL;
+  tp->lay.cls = NULL;
+  tp->lay.pos = NULL;
+  tp->lay.bit = NULL;
+  tp->lay.off = NULL;
+  tp->lay.wbytes = NULL;
+  tp->data = NULL;
+  tp->exp = NULL;
+  tp->index = NULL;
+  tp->slot = NULL;
+  init_rows(&tp->rows, 0);
+
+} /* end tt_begin() */
+
+static int set_error(tt_table *tp, int err) {
+  if (tp->err == TT_OK) {
+    tp->err = err;
+    tp->eline = tp->line;
+  }
+
+  return tp->err;
+
+} /* end set_error() */
+
+/*
+  The first non-blank line gives the number of address bits (abits)
+  and the number of ROMs (nroms), which are range-checked, and the
+  layout used to interpret the columns of the lines that follow, which
+  gives the width of each ROM's word.  The byte addresses of the words
+  must fit in TT_MAXBITS bits, as for the bytes of narrower ROMs.  The
+  ROM images are allocated then, too, so that the rest of the lines
+  can be compiled as they are given.
+ */
+int tt_add_line(tt_table *tp, char *line) {
+  address base, mask;
+  int len, ix, shift;
+
+  if (tp->err != TT_OK) return tp->err;
+
+  ++tp->line;
+
+  if (tp->rom == NULL) {
+    strip_comment(line);
+
+    /* Blank lines are skipped in all cases */
+    if (is_blank(line)) return TT_OK;
+
+    strip_whitespace(line);
+
+    /* Work out how to interpret the columns of the data lines, and
+       count the ROMs and address (state) bits
+     */
+    switch (make_layout(line, TT_MAXROMS, &tp->lay)) {
+      case LAYOUT_MEMORY:
+        return set_error(tp, TT_MEMORY);
+      case LAYOUT_BADCHAR:
+        return set_error(tp, TT_CONFIGCHAR);
+      case LAYOUT_MANY:
+        return set_error(tp, TT_MANYROMS);
+    }
+
+    tp->nroms = tp->lay.nroms;
+    tp->abits = tp->lay.abits;
+
+    if (tp->nroms < 1) return set_error(tp, TT_NOROMS);
+    if (tp->abits < 1 || tp->abits > TT_MAXBITS)
+      return set_error(tp, TT_ADDRBITS);
+
+    for (ix = 0; ix < tp->nroms; ix++) {
+      if (tp->lay.wbytes[ix] > TT_MAXWORD) return set_error(tp, TT_WORDBITS);
+
+      for (shift = 0; (1 << shift) < tp->lay.wbytes[ix];) ++shift;
+      if (tp->abits + shift > TT_MAXBITS) return set_error(tp, TT_ADDRBITS);
+    }
+
+    /* Route the columns to the pins they are wired to */
+    if (tp->opt.pins != NULL && !wire_layout(&tp->lay, tp->opt.pins))
+      return set_error(tp, TT_PINS);
+
+    /* Allocate space for the ROMs and their accumulators */
+    if (!alloc_roms(tp) ||
+        (tp->data = calloc(tp->lay.nbytes, sizeof(byte))) == NULL)
+      return set_error(tp, TT_MEMORY);
+
+    tp->wanted = tp->lay.width;
+    init_rows(&tp->rows, tp->lay.nbytes);
+
+    if (tp->opt.pipeline)
+      tp->exp = start_expander(tp->slot, tp->lay.nbytes, tp->abits,
+                               tp->opt.nthreads);
+
+    return TT_OK;
+  }
+
+  /* Compile the line into an address and the ROM data words */
+  switch (scan_line(line, &tp->lay, tp->opt.odcv, &base, &mask, tp->data,
+                    &len)) {
+    case SCAN_BLANK:
+      return TT_OK;
+
+    case SCAN_BADCHAR:
+      return set_error(tp, TT_DATACHAR);
+
+    case SCAN_LENGTH:
+      tp->got = len;
+      return set_error(tp, TT_LENGTH);
+
+    case SCAN_DATADC:
+      return set_error(tp, TT_DATADC);
+  }
+
+  /* Save the row; the ROM images are filled in once the whole table
+     has been given
+   */
+  if (!keep_row(tp, base, mask, tp->data, tp->line))
+    return set_error(tp, TT_MEMORY);
+
+  return TT_OK;
+
+} /* end tt_add_line() */
+
+static int keep_row(tt_table *tp, address base, address mask, byte *data,
+                    int line) {
+  if (!add_row(&tp->rows, base, mask, data, line)) return 0;
+
+  if (tp->exp) expand_row(tp->exp, base, mask, data);
+
+  return 1;
+
+} /* end keep_row() */
+
+int tt_end(tt_table *tp) {
+  if (tp->err != TT_OK) return tp->err;
+
+  /* If we didn't get a first line at all, the table was logically
+     empty (i.e., not even a configuration!)
+   */
+  if (tp->rom == NULL) {
+    set_error(tp, TT_NOCONFIG);
+    tp->eline = 0;
+    return tp->err;
+  }
+
+  if (tp->exp) {
+    int ok = finish_expander(tp->exp);
+
+    tp->exp = NULL;
+    if (!ok) return set_error(tp, TT_MEMORY);
+
+  } else if (!apply_rows(&tp->rows, tp->slot, tp->abits, tp->opt.nthreads)) {
+    return set_error(tp, TT_MEMORY);
+  }
+
+  return TT_OK;
+
+} /* end tt_end() */
+
+int tt_check(tt_table *tp, overlap_func report, void *arg, long *count) {
+  *count = 0;
+
+  if (tp->err != TT_OK) return tp->err;
+
+  if (tp->rom == NULL) {
+    set_error(tp, TT_NOCONFIG);
+    tp->eline = 0;
+    return tp->err;
+  }
+
+  if ((*count = find_overlaps(&tp->rows, tp->abits, report, arg)) < 0) {
+    *count = 0;
+    return set_error(tp, TT_MEMORY);
+  }
+
+  return TT_OK;
+
+} /* end tt_check() */
+
+int tt_index(tt_table *tp) {
+  if (tp->err != TT_OK) return tp->err;
+
+  if (tp->rom == NULL) {
+    set_error(tp, TT_NOCONFIG);
+    tp->eline = 0;
+    return tp->err;
+  }
+
+  if (tp->index == NULL &&
+      (tp->index = index_rows(&tp->rows, tp->abits)) == NULL)
+    return set_error(tp, TT_MEMORY);
+
+  return TT_OK;
+
+} /* end tt_index() */
+
+int tt_lookup(tt_table *tp, address addr, byte *data) {
+  int ix = last_row(tp->index, addr);
+
+  if (ix < 0) {
+    memset(data, tp->opt.fill, tp->lay.nbytes);
+    return 0;
+  }
+
+  memcpy(data, tp->rows.data + ix * tp->lay.nbytes, tp->lay.nbytes);
+
+  return tp->rows.rows[ix].line;
+
+} /* end tt_lookup() */
+
+void tt_find(tt_table *tp, address base, address mask, row_func fn,
+             void *arg) {
+  find_rows(tp->index, base, mask, fn, arg);
+
+} /* end tt_find() */
+
+int tt_list(tt_table *tp, address base, address mask, int **rows,
+            int *nalloc) {
+  return list_rows(tp->index, base, mask, rows, nalloc);
+
+} /* end tt_list() */
+
+/*
+  Lines are cut from the text at each newline, as read_line() cuts
+  them from a file, so that a table gives the same results either way.
+  Each is copied into a buffer that grows to hold the longest line,
+  since tt_add_line() may modify it.
+ */
+int tt_parse(tt_table *tp, tt_options *opt, const char *text, size_t len) {
+  char *buf = NULL;
+  size_t pos = 0, size = 0, end;
+
+  tt_begin(tp, opt);
+
+  while (pos < len && tp->err == TT_OK) {
+    for (end = pos; end < len && text[end] != '\n';) ++end;
+
+    if (end - pos >= size) {
+      char *nbuf = realloc(buf, end - pos + 1);
+
+      if (nbuf == NULL) {
+        set_error(tp, TT_MEMORY);
+        break;
+      }
+      buf = nbuf;
+      size = end - pos + 1;
+    }
+
+    memcpy(buf, text + pos, end - pos);
+    buf[end - pos] = '\0';
+    pos = end + 1;
+
+    tt_add_line(tp, buf);
+  }
+
+  free(buf);
+
+  return tp->err;
+
+} /* end tt_parse() */
+
+int tt_compile(tt_table *tp, tt_options *opt, const char *text, size_t len) {
+  tt_parse(tp, opt, text, len);
+
+  return tt_end(tp);
+
+} /* end tt_compile() */
+
+unsigned long tt_hash(unsigned long h, const char *text, size_t len) {
+  size_t ix;
+
+  for (ix = 0; ix < len; ix++)
+    h = ((h ^ (unsigned char)text[ix]) * FNV_PRIME) & MASK32;
+
+  return h;
+
+} /* end tt_hash() */
+
+/* Store 'val' in the four bytes at 'buf', least significant first */
+static void put_word(byte *buf, unsigned long val) {
+  buf[0] = (byte)(val & 0xFF);
+  buf[1] = (byte)((val >> 8) & 0xFF);
+  buf[2] = (byte)((val >> 16) & 0xFF);
+  buf[3] = (byte)((val >> 24) & 0xFF);
+
+} /* end put_word() */
+
+/* Fetch the value stored at 'buf' by put_word() */
+static unsigned long get_word(const byte *buf) {
+  return (unsigned long)buf[0] | ((unsigned long)buf[1] << 8) |
+         ((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
+
+} /* end get_word() */
+
+/*
+  A compiled table is a header of 32-bit words, stored least
+  significant byte first:
+
+    magic    - the characters of TT_MAGIC
+    version  - TT_CVERSION
+    hash     - hash of the source text
+    lines    - lines in the source
+    rows     - number of records
+    width    - characters of the configuration line
+    odcv     - output don't-care value, '0' or '1'
+
+  then the configuration line itself, without whitespace or comments,
+  and then a record for each row: its base, mask, and line number as
+  32-bit words, and the data words of the ROMs, as the layout of the
+  configuration line packs them.
+ */
+int tt_save(tt_table *tp, unsigned long hash, sink_func put, void *arg) {
+  byte buf[SAVE_SIZE];
+  size_t len, rlen, clen;
+  int ix;
+
+  if (tp->err != TT_OK) return 0;
+
+  if (tp->rom == NULL) {
+    set_error(tp, TT_NOCONFIG);
+    tp->eline = 0;
+    return 0;
+  }
+
+  memcpy(buf, TT_MAGIC, 4);
+  put_word(buf + 4, TT_CVERSION);
+  put_word(buf + 8, hash);
+  put_word(buf + 12, tp->line);
+  put_word(buf + 16, tp->rows.nrows);
+  put_word(buf + 20, clen = strlen(tp->lay.config));
+  put_word(buf + 24, tp->opt.odcv);
+
+  /* The configuration line may be longer than the buffer */
+  if (!put(arg, (char *)buf, HDR_SIZE) ||
+      !put(arg, tp->lay.config, clen))
+    return 0;
+
+  len = 0;
+  rlen = REC_FIXED + tp->lay.nbytes;
+
+  for (ix = 0; ix < tp->rows.nrows; ix++) {
+    row *rp = tp->rows.rows + ix;
+
+    if (len + rlen > SAVE_SIZE) {
+      if (!put(arg, (char *)buf, len)) return 0;
+      len = 0;
+    }
+
+    put_word(buf + len, rp->base);
+    put_word(buf + len + 4, rp->mask);
+    put_word(buf + len + 8, rp->line);
+    memcpy(buf + len + REC_FIXED, tp->rows.data + ix * tp->lay.nbytes,
+           tp->lay.nbytes);
+    len += rlen;
+  }
+
+  return (len == 0 || put(arg, (char *)buf, len));
+
+} /* end tt_save() */
+
+/*
+  The configuration line is given to tt_add_line(), just as if it had
+  been read from the source, so that it is checked and the ROM images
+  are set up in the usual way (and so that named ROMs are numbered as
+  they were).  Each record is checked to be a cube of the table's
+  address space, since apply_rows() counts on that, and to name one of
+  the table's lines, since reports index by them.
+ */
+int tt_load(tt_table *tp, tt_options *opt, const byte *buf, size_t len,
+            unsigned long *hash) {
+  unsigned long width, nrows, lines;
+  char *config;
+  size_t rlen;
+  int ix;
+
+  tt_begin(tp, opt);
+  tp->opt.pins = NULL;
+  *hash = 0;
+
+  if (len < HDR_SIZE || memcmp(buf, TT_MAGIC, 4) != 0 ||
+      get_word(buf + 4) != TT_CVERSION)
+    return set_error(tp, TT_BADCOMPILED);
+
+  *hash = get_word(buf + 8);
+  lines = get_word(buf + 12);
+  nrows = get_word(buf + 16);
+  width = get_word(buf + 20);
+  tp->opt.odcv = (get_word(buf + 24) == '0') ? '0' : '1';
+
+  if (width == 0 || width > len - HDR_SIZE || lines > INT_MAX ||
+      memchr(buf + HDR_SIZE, '#', width) != NULL)
+    return set_error(tp, TT_BADCOMPILED);
+
+  if ((config = malloc(width + 1)) == NULL) return set_error(tp, TT_MEMORY);
+
+  memcpy(config, buf + HDR_SIZE, width);
+  config[width] = '\0';
+
+  tt_add_line(tp, config);
+  free(config);
+
+  if (tp->err == TT_CONFIGCHAR) tp->err = TT_BADCOMPILED;
+  if (tp->err != TT_OK) return tp->err;
+
+  buf += HDR_SIZE + width;
+  len -= HDR_SIZE + width;
+  rlen = REC_FIXED + tp->lay.nbytes;
+
+  if (nrows > len / rlen) return set_error(tp, TT_BADCOMPILED);
+
+  for (ix = 0; ix < (int)nrows; ix++, buf += rlen) {
+    address base = get_word(buf), mask = get_word(buf + 4);
+    unsigned long line = get_word(buf + 8);
+
+    if ((base & mask) != 0 || ((base | mask) & ~LOW_BITS(tp->abits)) != 0 ||
+        line < 1 || line > lines)
+      return set_error(tp, TT_BADCOMPILED);
+
+    if (!keep_row(tp, base, mask, (byte *)buf + REC_FIXED, (int)line))
+      return set_error(tp, TT_MEMORY);
+  }
+
+  tp->line = (int)lines;
+
+  return TT_OK;
+
+} /* end tt_load() */
+
+void tt_free(tt_table *tp) {
+  /* The expander threads must be stopped before the images go */
+  if (tp->exp) {
+    finish_expander(tp->exp);
+    tp->exp = NULL;
+  }
+
+  if (tp->index) {
+    free_index(tp->index);
+    tp->index = NULL;
+  }
+
+  free_layout(&tp->lay);
+  free_rows(&tp->rows);
+
+  if (tp->rom) {
+    free_roms(tp);
+    free(tp->rom);
+    tp->rom = NULL;
+  }
+
+  free(tp->slot);
+  tp->slot = NULL;
+
+  free(tp->data);
+  tp->data = NULL;
+
+} /* end tt_free() */
+
+/* log2 of the bytes in the widest word of a table's ROMs */
+static int word_shift(tt_table *tp) {
+  int ix, shift = 0;
+
+  if (tp->lay.wbytes == NULL) return 0;
+
+  for (ix = 0; ix < tp->lay.nroms; ix++)
+    while ((1 << shift) < tp->lay.wbytes[ix] && shift < TT_MAXBITS) ++shift;
+
+  return shift;
+
+} /* end word_shift() */
+
+void tt_message(tt_table *tp, char *buf) {
+  switch (tp->err) {
+    case TT_OK:
+      strcpy(buf, "No error");
+      break;
+    case TT_MEMORY:
+      strcpy(buf, "Insufficient memory to process file");
+      break;
+    case TT_CONFIGCHAR:
+      sprintf(buf, "Line %d: invalid character in configuration", tp->eline);
+      break;
+    case TT_NOROMS:
+      sprintf(buf, "Line %d: must specify at least 1 ROM number", tp->eline);
+      break;
+    case TT_MANYROMS:
+      sprintf(buf, "Line %d: cannot specify more than %d ROMs", tp->eline,
+              TT_MAXROMS);
+      break;
+    case TT_ADDRBITS:
+      sprintf(buf, "Line %d: must have between 1-%d state bits", tp->eline,
+              TT_MAXBITS - word_shift(tp));
+      break;
+    case TT_DATACHAR:
+      sprintf(buf, "Line %d: invalid character in data", tp->eline);
+      break;
+    case TT_LENGTH:
+      sprintf(buf, "Line %d: wrong number of fields (wanted %u, got %u)",
+              tp->eline, (unsigned)tp->wanted, (unsigned)tp->got);
+      break;
+    case TT_DATADC:
+      sprintf(buf, "Line %d: illegal don't-care bit in data", tp->eline);
+      break;
+    case TT_NOCONFIG:
+      strcpy(buf, "No configuration line was found");
+      break;
+    case TT_BADCOMPILED:
+      strcpy(buf, "Compiled table is damaged, or from a newer version");
+      break;
+    case TT_WORDBITS:
+      sprintf(buf, "Line %d: a ROM may have at most %d data bits", tp->eline,
+              TT_MAXWORD * CHAR_BIT);
+      break;
+    case TT_PINS:
+      sprintf(buf, "Line %d: pin assignment does not fit the configuration",
+              tp->eline);
+      break;
+    default:
+      strcpy(buf, "Unknown error");
+      break;
+  }
+
+} /* end tt_message() */
+
+char *tt_rom_name(tt_table *tp, int num) {
+  if (tp->rom == NULL || num < 0 || num >= tp->nroms) return NULL;
+
+  return tp->lay.names[num];
+
+} /* end tt_rom_name() */
+
+int tt_word_bytes(tt_table *tp, int num) {
+  if (tp->rom == NULL || num < 0 || num >= tp->nroms) return 0;
+
+  return tp->lay.wbytes[num];
+
+} /* end tt_word_bytes() */
+
+int tt_read_rom(tt_table *tp, int num, address start, address count,
+                byte *buf) {
+  byte *plane;
+  address last;
+  image *img;
+  int wbytes;
+
+  if (tp->err != TT_OK || num < 0 || num >= tp->nroms ||
+      (img = tp->rom[num]) == NULL)
+    return 0;
+
+  last = LOW_BITS(tp->abits);
+  if (count == 0) return 1;
+  if (start > last || count - 1 > last - start) return 0;
+
+  wbytes = tp->lay.wbytes[num];
+  if ((plane = malloc((size_t)wbytes << img->pbits)) == NULL) return 0;
+
+  /* Copy a page, or what is wanted of it, at a time */
+  while (count > 0) {
+    address off = start & LOW_BITS(img->pbits);
+    address len = ((address)1 << img->pbits) - off;
+    byte *data = image_lanes(img, LANE(tp, num), wbytes, tp->opt.enc.big,
+                             start >> img->pbits, plane);
+
+    if (len > count) len = count;
+
+    memcpy(buf, data + off * wbytes, len * wbytes);
+
+    buf += len * wbytes;
+    start += len;
+    count -= len;
+  }
+
+  free(plane);
+
+  return 1;
+
+} /* end tt_read_rom() */
+
+/* Every row is written into a scratch image, and the locations that
+   end up set are counted; for each row, 2^k addresses are written,
+   where k is the number of don't-care bits in it.
+ */
+int tt_coverage(tt_table *tp, double *written, double *distinct) {
+  image *cov;
+  address pnum, mask;
+  int ix, psize;
+
+  if ((cov = new_image(tp->abits, 1, 0)) == NULL) return 0;
+
+  *written = *distinct = 0;
+
+  for (ix = 0; ix < tp->rows.nrows; ix++) {
+    row *rp = tp->rows.rows + ix;
+    double count = 1;
+
+    for (mask = rp->mask; mask != 0; mask &= mask - 1) count *= 2;
+    *written += count;
+
+    if (!write_cube(cov, rp->base, rp->mask, 1)) {
+      free_image(cov);
+      return 0;
+    }
+  }
+
+  psize = 1 << cov->pbits;
+  for (pnum = 0; pnum < cov->npages; pnum++)
+    if (cov->page[pnum] != NULL)
+      for (ix = 0; ix < psize; ix++) *distinct += cov->page[pnum][ix];
+
+  free_image(cov);
+
+  return 1;
+
+} /* end tt_coverage() */
+
+double tt_image_size(tt_table *tp) {
+  double size = 0;
+  int ix, jx;
+
+  if (tp->rom == NULL) return 0;
+
+  /* An interleaved image is counted once, for its first ROM */
+  for (ix = 0; ix < tp->nroms; ix++) {
+    if (tp->rom[ix] == NULL) continue;
+
+    for (jx = 0; jx < ix; jx++)
+      if (tp->rom[jx] == tp->rom[ix]) break;
+
+    if (jx == ix) size += image_size(tp->rom[ix]);
+  }
+
+  return size;
+
+} /* end tt_image_size() */
+
+int tt_encode(tt_table *tp, int num, int fmt, sink_func put, void *arg) {
+  encoding en;
+
+  if (tp->err != TT_OK || num < 0 || num >= tp->nroms || tp->rom[num] == NULL)
+    return 0;
+
+  en = tp->opt.enc;
+  en.wbytes = tp->lay.wbytes[num];
+
+  return encode_image(tp->rom[num], LANE(tp, num), fmt, &en, put, arg);
+
+} /* end tt_encode() */
+
+/*
+  Each lane has an encoder of its own, and they take turns with the
+  pages, so that each page is read while it is still in the cache.
+ */
+int tt_encode_lanes(tt_table *tp, int num, int fmt, sink_func put,
+                    void **args) {
+  encoder *enc[TT_MAXWORD];
+  address pnum;
+  encoding en;
+  image *img;
+  int ix, nenc = 0, ok = 1;
+
+  if (tp->err != TT_OK || num < 0 || num >= tp->nroms ||
+      (img = tp->rom[num]) == NULL || fmt < TT_RAW || fmt > TT_CARRAY)
+    return 0;
+
+  en = tp->opt.enc;
+  en.wbytes = 1;
+
+  for (ix = 0; ix < tp->lay.wbytes[num]; ix++) {
+    if (args[ix] != NULL &&
+        (enc[nenc++] = start_encoding(img, BYTE_LANE(tp, num, ix), fmt, &en,
+                                      put, args[ix])) == NULL)
+      ok = 0;
+  }
+
+  for (pnum = 0; pnum < img->npages && ok; pnum++)
+    for (ix = 0; ix < nenc; ix++)
+      if (!encode_pages(enc[ix], pnum, 1)) ok = 0;
+
+  for (ix = 0; ix < nenc; ix++)
+    if (enc[ix] != NULL && !finish_encoding(enc[ix])) ok = 0;
+
+  return ok;
+
+} /* end tt_encode_lanes() */
+
+image *tt_byte_image(tt_table *tp, int num, int lane) {
+  image *img;
+
+  if (tp->err != TT_OK || num < 0 || num >= tp->nroms ||
+      (img = tp->rom[num]) == NULL || lane >= tp->lay.wbytes[num])
+    return NULL;
+
+  if (lane >= 0) return unpack_words(img, BYTE_LANE(tp, num, lane), 1, 0);
+
+  return unpack_words(img, LANE(tp, num), tp->lay.wbytes[num],
+                      tp->opt.enc.big);
+
+} /* end tt_byte_image() */
+
+/*
+  The scratch image has a lane for every byte of a row's data, so each
+  row is written once per window for all the ROMs.  A window is a
+  whole number of pages, aligned on its size, so it is itself a cube
+  of addresses.  Split or not, every output is encoded from the same
+  scratch image, so the words are resolved only once.
+ */
+int tt_stream(tt_table *tp, int fmt, sink_func put, void **args) {
+  encoder *enc[TT_MAXROMS * TT_MAXWORD];
+  address win, nwins, first, npages;
+  encoding en;
+  image *img;
+  int *rows = NULL, nalloc = 0, nenc = 0;
+  int ix, k, nrows, wbits, ok = 1, mem = 1;
+
+  if (tt_index(tp) != TT_OK) return 0;
+
+  if (fmt < TT_RAW || fmt > TT_CARRAY) return 0;
+
+  if ((img = new_image(tp->abits, tp->lay.nbytes, tp->opt.fill)) == NULL) {
+    set_error(tp, TT_MEMORY);
+    return 0;
+  }
+
+  en = tp->opt.enc;
+
+  for (ix = 0; ix < tp->nroms; ix++) {
+    if (tp->rom[ix] == NULL) continue;
+
+    if (!tp->opt.split) {
+      en.wbytes = tp->lay.wbytes[ix];
+      if (args[ix] != NULL &&
+          (enc[nenc++] = start_encoding(img, tp->lay.off[ix], fmt, &en, put,
+                                        args[ix])) == NULL)
+        mem = 0;
+      continue;
+    }
+
+    en.wbytes = 1;
+    for (k = 0; k < tp->lay.wbytes[ix]; k++) {
+      int lane = tp->lay.off[ix] +
+                 (en.big ? tp->lay.wbytes[ix] - 1 - k : k);
+      void *arg = args[ix * TT_MAXWORD + k];
+
+      if (arg != NULL && (enc[nenc++] = start_encoding(img, lane, fmt, &en,
+                                                       put, arg)) == NULL)
+        mem = 0;
+    }
+  }
+
+  wbits = img->pbits + WINDOW_BITS;
+  if (wbits > tp->abits) wbits = tp->abits;
+
+  nwins = (address)1 << (tp->abits - wbits);
+  npages = (address)1 << (wbits - img->pbits);
+
+  for (win = 0; win < nwins && ok && mem; win++) {
+    address wbase = win << wbits, base, mask;
+
+    /* Write the rows that reach into the window, in order */
+    nrows = list_rows(tp->index, wbase, LOW_BITS(wbits), &rows, &nalloc);
+
+    for (ix = 0; ix < nrows && mem; ix++) {
+      row *rp = tp->rows.rows + rows[ix];
+
+      cube_intersect(rp->base, rp->mask, wbase, LOW_BITS(wbits), &base, &mask);
+      mem = write_words(img, base, mask,
+                        tp->rows.data + rows[ix] * tp->lay.nbytes);
+    }
+    if (nrows < 0 || !mem) {
+      mem = 0;
+      break;
+    }
+
+    first = wbase >> img->pbits;
+    for (ix = 0; ix < nenc; ix++)
+      if (!encode_pages(enc[ix], first, npages)) ok = 0;
+
+    release_pages(img, first, npages);
+  }
+
+  for (ix = 0; ix < nenc; ix++)
+    if (enc[ix] != NULL && !finish_encoding(enc[ix])) ok = 0;
+
+  if (!mem) {
+    set_error(tp, TT_MEMORY);
+    ok = 0;
+  }
+
+  free(rows);
+  free_image(img);
+
+  return ok;
+
+} /* end tt_stream() */
+
+/*
+  Each ROM in use has an image with a lane for each byte of its word.
+  If the table is to be interleaved, a single image is made with a
+  lane for each byte of a row's data, and every ROM in use points to
+  it.  Each byte of the data is given the image it is written to.
+ */
+static int alloc_roms(tt_table *tp) {
+  image *words = NULL; /* shared image, if interleaved */
+  int rnum, ix;
+
+  if ((tp->rom = calloc(tp->nroms, sizeof(image *))) == NULL ||
+      (tp->slot = calloc(tp->lay.nbytes, sizeof(image *))) == NULL)
+    return 0;
+
+  if (tp->opt.interleave &&
+      (words = new_image(tp->abits, tp->lay.nbytes, tp->opt.fill)) == NULL)
+    return 0;
+
+  for (rnum = 0; rnum < tp->nroms; rnum++) {
+    int width = tp->lay.wbytes[rnum];
+
+    if (width == 0) continue;
+
+    if (words) {
+      tp->rom[rnum] = words;
+    } else {
+      if (tp->opt.new_rom != NULL)
+        tp->rom[rnum] = tp->opt.new_rom(tp->opt.rom_arg, rnum, tp->abits,
+                                        width, tp->opt.fill);
+
+      if (tp->rom[rnum] == NULL &&
+          (tp->rom[rnum] = new_image(tp->abits, width, tp->opt.fill)) == NULL)
+        return 0; /* tt_free() will clean up any we already got */
+    }
+
+    for (ix = 0; ix < width; ix++)
+      tp->slot[tp->lay.off[rnum] + ix] = tp->rom[rnum];
+  }
+
+  return 1;
+
+} /* end alloc_roms() */
+
+static void free_roms(tt_table *tp) {
+  int ix, jx;
+
+  for (ix = 0; ix < tp->nroms; ix++)
+    if (tp->rom[ix]) {
+      image *img = tp->rom[ix];
+
+      /* An interleaved image is shared; release it only once */
+      for (jx = ix; jx < tp->nroms; jx++)
+        if (tp->rom[jx] == img) tp->rom[jx] = NULL;
+
+      free_image(img);
+    }
+
+} /* end free_roms() */
+
+/* Here there be dragons */
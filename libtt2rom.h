@@ -0,0 +1,291 @@
+/*
+  libtt2rom.h
+
+  Compiling truth tables into ROM images in memory, for programs that
+  embed tt2rom version 2.  Nothing here reads or writes files, or
+  keeps any state outside the tt_table it is given, so any number of
+  tables may be compiled at once in separate threads.
+ */
+
+#ifndef _H_LIBTT2ROM_
+#define _H_LIBTT2ROM_
+
+#include <stddef.h>
+
+#include "rom.h"
+#include "table.h"
+
+#define TT_MAXROMS 64  /* maximum number of ROM images        */
+#define TT_MAXBITS 32  /* maximum number of bits in address   */
+#define TT_MAXWORD 8   /* bytes in the widest ROM data word   */
+#define TT_MSGLEN 128  /* room needed by tt_message()         */
+
+/* Output formats for tt_encode(), the same as the codes in rom.h */
+#define TT_RAW 1    /* raw binary bytes                    */
+#define TT_TEXT 2   /* hexadecimal bytes, human-readable   */
+#define TT_INTEL 3  /* Intel HEX records                   */
+#define TT_SREC 4   /* Motorola S-records                  */
+#define TT_TITXT 5  /* TI-TXT                              */
+#define TT_VMEM 6   /* Verilog $readmemh                   */
+#define TT_CARRAY 7 /* C array initialiser                 */
+
+/* Errors a table may have */
+#define TT_OK 0          /* no error                              */
+#define TT_MEMORY 1      /* memory could not be had               */
+#define TT_CONFIGCHAR 2  /* invalid character in configuration    */
+#define TT_NOROMS 3      /* configuration names no ROMs           */
+#define TT_MANYROMS 4    /* configuration names too many ROMs     */
+#define TT_ADDRBITS 5    /* too few or too many address bits      */
+#define TT_DATACHAR 6    /* invalid character in a data line      */
+#define TT_LENGTH 7      /* wrong number of fields on a data line */
+#define TT_DATADC 8      /* don't-care bit in an output           */
+#define TT_NOCONFIG 9    /* no configuration line was found       */
+#define TT_BADCOMPILED 10 /* compiled table is damaged or too new  */
+#define TT_WORDBITS 11   /* a ROM has too many data bits          */
+#define TT_PINS 12       /* pins do not fit the configuration     */
+
+/* Compiled tables, as written by tt_save() */
+#define TT_MAGIC "tt2c"  /* first four bytes of a compiled table  */
+#define TT_CVERSION 2    /* version of the compiled format        */
+#define TT_HASHINIT 2166136261UL /* starting value for tt_hash()  */
+
+/* Revision of the ROM images and files made from a table.  It must be
+   bumped whenever the same table and options give different output,
+   since caches of output files are keyed by it.
+ */
+#define TT_OUTREV 2
+
+/* Makes the image for ROM number 'num' of a table, 'width' bytes wide
+   (one lane for each byte of its word), in place of new_image(), as
+   for writing it straight into a file with map_image().  Returns NULL
+   to have an ordinary image made instead.  It is not used for an
+   interleaved table.
+ */
+typedef image *(*rom_func)(void *arg, int num, int abits, int width,
+                           byte fill);
+
+/* Settings for compiling a table */
+typedef struct {
+  char odcv;      /* output don't-care value, '0' or '1' */
+  byte fill;      /* value of unwritten locations        */
+  int interleave; /* one image for all ROMs?             */
+  int nthreads;   /* threads used to fill in the images  */
+  int pipeline;   /* fill them in while lines are given? */
+  int split;      /* tt_stream(): a file per word byte?  */
+  encoding enc;   /* how output records are laid out     */
+  char *pins;     /* wiring, for wire_layout(), or NULL  */
+  rom_func new_rom; /* makes the images, if not NULL     */
+  void *rom_arg;    /* ... and is passed this            */
+} tt_options;
+
+/* A table being compiled, and the ROM images built from it.  The
+   fields up to 'got' may be read by the caller; the rest are private.
+
+   Each ROM's data word is as wide as its columns on the configuration
+   line need: 8, 16, 32 or 64 bits (see tt_word_bytes()).  Its image
+   has a lane for each byte of the word, least significant first, and
+   an interleaved image has all the lanes of all the ROMs.  The words
+   are written out in the byte order given by the 'big' field of the
+   'enc' option.
+ */
+typedef struct {
+  tt_options opt;
+  int nroms;   /* ROM numbers in use, highest + 1       */
+  int abits;   /* number of address bits                */
+  image **rom; /* images, NULL for unused ROM numbers   */
+  int line;    /* number of lines given so far          */
+  int err;     /* first error found, or TT_OK           */
+  int eline;   /* line the error was found on           */
+  int wanted;  /* for TT_LENGTH, the fields expected... */
+  int got;     /* ... and the fields found              */
+
+  layout lay;
+  rowset rows;
+  byte *data;
+  expander *exp;
+  rowindex *index;
+  image **slot;
+} tt_table;
+
+/* Fill in the default settings */
+void tt_defaults(tt_options *opt);
+
+/* Start compiling a table with the given settings */
+void tt_begin(tt_table *tp, tt_options *opt);
+
+/* Compile the next line of a table, which has had its newline removed
+   and which may be modified.  The first non-blank line is taken to be
+   the configuration line, as make_layout() reads it, with ROM numbers
+   below TT_MAXROMS, and wired to the pins given by the 'pins' option.
+   The addresses and data words of the rows are then those the pins
+   of the ROMs see.  Lines may be of any length.  Once an error is
+   found, further lines are ignored.  Returns the table's error code.
+ */
+int tt_add_line(tt_table *tp, char *line);
+
+/* Finish compiling a table, filling in its ROM images from the rows
+   given.  Returns the table's error code.
+
+   If the 'pipeline' option is set (and thread support is available),
+   the images are filled in by other threads as the lines are given,
+   and this waits for them to finish.
+ */
+int tt_end(tt_table *tp);
+
+/* Instead of tt_end(), look for rows that overlap and write different
+   data, calling 'report' for each pair as find_overlaps() describes,
+   and store the number of pairs in 'count'.  The ROM images are not
+   filled in.  Returns the table's error code.
+ */
+int tt_check(tt_table *tp, overlap_func report, void *arg, long *count);
+
+/* Instead of tt_end(), index the rows of a table so that tt_lookup()
+   and tt_find() may be used.  The ROM images are not filled in, and
+   the memory used grows with the number of rows, not the size of the
+   address space.  Returns the table's error code.
+ */
+int tt_index(tt_table *tp);
+
+/* Find what the ROM images of an indexed table would hold at address
+   'addr', storing the data words of the ROMs in 'data', or the fill
+   value if no row covers the address.  The words are stored one after
+   another in order of ROM number, each of tt_word_bytes() bytes, least
+   significant first, so 'data' needs room for TT_MAXROMS * TT_MAXWORD
+   bytes at most.  Returns the line of the row that gives them, or 0 if
+   there is none.
+ */
+int tt_lookup(tt_table *tp, address addr, byte *data);
+
+/* Call 'fn' for every row of an indexed table that has some address in
+   common with the cube (base, mask), in no particular order
+ */
+void tt_find(tt_table *tp, address base, address mask, row_func fn,
+             void *arg);
+
+/* As tt_find(), but store the numbers of the rows in '*rows', in
+   order, as list_rows() does
+ */
+int tt_list(tt_table *tp, address base, address mask, int **rows,
+            int *nalloc);
+
+/* Compile a whole table from the 'len' bytes at 'text', split into
+   lines as the tt2rom program reads them from a file.  Returns the
+   table's error code.  The table must be released with tt_free()
+   whether or not this succeeds.
+ */
+int tt_compile(tt_table *tp, tt_options *opt, const char *text, size_t len);
+
+/* As tt_compile(), but stop short of tt_end(), so that the lines have
+   been compiled into rows but the ROM images are not yet filled in
+ */
+int tt_parse(tt_table *tp, tt_options *opt, const char *text, size_t len);
+
+/* Add the 'len' bytes at 'text' to the hash 'h' (start with
+   TT_HASHINIT), and return the new value.  This is the 32-bit FNV-1a
+   hash, which tt_save() records for the source of a table.
+ */
+unsigned long tt_hash(unsigned long h, const char *text, size_t len);
+
+/* Write a table that has been compiled into rows (by tt_parse(), or
+   tt_add_line() without tt_end()) in the compiled format, passing it
+   to 'put' as described in rom.h.  The format holds the layout of the
+   columns, the rows with their data words and line numbers, and
+   'hash', which should be tt_hash() of the source text.  Returns false
+   if the table has an error (such as having no configuration line),
+   or 'put' failed.
+ */
+int tt_save(tt_table *tp, unsigned long hash, sink_func put, void *arg);
+
+/* As tt_parse(), but from the 'len' bytes of a compiled table at
+   'buf', skipping all text handling.  The source hash it records is
+   stored in 'hash'.  Output don't-care bits were settled when the
+   table was compiled, so the 'odcv' of the table's options is set to
+   the value used then; its rows were wired to their pins then as well,
+   so the 'pins' option is not used.  The bytes at 'buf' are not needed
+   once this returns.  Returns the table's error code.
+ */
+int tt_load(tt_table *tp, tt_options *opt, const byte *buf, size_t len,
+            unsigned long *hash);
+
+/* Release the memory used by a table and its ROM images */
+void tt_free(tt_table *tp);
+
+/* Describe a table's error in words, as the tt2rom program reports
+   it, in 'buf', which must have room for TT_MSGLEN characters.
+ */
+void tt_message(tt_table *tp, char *buf);
+
+/* The name ROM number 'num' was given on the configuration line, or
+   NULL if it was given by number, or there is no such ROM
+ */
+char *tt_rom_name(tt_table *tp, int num);
+
+/* Bytes in the data word of ROM number 'num': 1, 2, 4 or 8, or 0 if
+   there is no such ROM
+ */
+int tt_word_bytes(tt_table *tp, int num);
+
+/* Copy 'count' words of ROM number 'num', from address 'start' on,
+   into the caller's buffer 'buf', tt_word_bytes() bytes each, in the
+   table's byte order.  Returns false if there is no such ROM, or the
+   range does not lie within it, or memory could not be had.
+ */
+int tt_read_rom(tt_table *tp, int num, address start, address count,
+                byte *buf);
+
+/* Count the addresses written by the rows of a compiled table, with
+   'written' counting an address once for each row that covers it, and
+   'distinct' only once, so that the difference is the number of
+   writes that replaced an earlier row's data.  Memory for one more
+   byte-wide image is needed; returns false if it could not be had.
+ */
+int tt_coverage(tt_table *tp, double *written, double *distinct);
+
+/* Bytes of memory used by the ROM images of a table */
+double tt_image_size(tt_table *tp);
+
+/* Encode ROM number 'num' in format 'fmt' (one of the TT_xxx formats
+   above), laid out as the table's 'enc' option says, and pass the
+   output to 'put' as described in rom.h.  A word of several bytes is
+   written at as many consecutive byte addresses.  Returns false if
+   there is no such ROM, or 'put' failed.
+ */
+int tt_encode(tt_table *tp, int num, int fmt, sink_func put, void *arg);
+
+/* As tt_encode(), but split the words of the ROM into their bytes, and
+   encode each byte lane as a ROM of its own, one byte wide.  The lanes
+   are counted in the order tt_encode() writes the bytes of a word: so
+   for 16-bit words, lanes 0 and 1 are its even and odd bytes.  The
+   output for lane 'k' is passed to 'put' with 'args[k]', and lanes
+   whose 'args' entry is NULL are skipped.  The image is walked once,
+   a page at a time, for all the lanes.  Returns false if there is no
+   such ROM, 'put' failed, or memory could not be had.
+ */
+int tt_encode_lanes(tt_table *tp, int num, int fmt, sink_func put,
+                    void **args);
+
+/* Make an image one byte wide holding ROM number 'num' as tt_encode()
+   writes it, or if 'lane' is not negative, just that byte lane of it,
+   as tt_encode_lanes() writes it; as for reading back its file to
+   compare.  Returns NULL if there is no such ROM, or memory could not
+   be had.  The image must be released with free_image().
+ */
+image *tt_byte_image(tt_table *tp, int num, int lane);
+
+/* Encode every ROM of a table in format 'fmt' (as for tt_encode()),
+   without filling in its ROM images.  The output for ROM number 'n'
+   is passed to 'put' with 'args[n]', and ROMs whose 'args' entry is
+   NULL are skipped.  If the 'split' option is set, the byte lanes of
+   each word are encoded as tt_encode_lanes() would, with the output
+   for lane 'k' of ROM 'n' going to 'args[n * TT_MAXWORD + k]'.  The
+   rows are indexed (as by tt_index()), and the address space is
+   walked in order, a window at a time: the rows covering a window are
+   written into a scratch image, which is encoded and then released.
+   Thus the memory used grows with the number of rows, not the size of
+   the address space, and output begins before the whole table has
+   been resolved.  Returns false if the table has an error (including
+   running out of memory), or 'put' failed.
+ */
+int tt_stream(tt_table *tp, int fmt, sink_func put, void **args);
+
+#endif /* end _H_LIBTT2ROM_ */
@@ -0,0 +1,93 @@
+/*
+  mapfile.c
+
+  Reading a whole file into memory, by mapping it where that is
+  possible, for tt2rom version 2.
+
+  If USE_MMAP is defined, files are mapped with mmap(), so that their
+  pages are read only as they are used.  Otherwise, or if a file
+  cannot be mapped, it is read into memory allocated for it.
+ */
+
+#include "mapfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Read the file into allocated memory */
+static int read_file(char *path, mapping *mp) {
+  FILE *ifp;
+  long len;
+
+  if ((ifp = fopen(path, "rb")) == NULL) return 0;
+
+  if (fseek(ifp, 0, SEEK_END) != 0 || (len = ftell(ifp)) < 0 ||
+      fseek(ifp, 0, SEEK_SET) != 0 ||
+      (mp->data = malloc(len ? len : 1)) == NULL) {
+    fclose(ifp);
+    return 0;
+  }
+
+  mp->len = (size_t)len;
+  mp->mapped = 0;
+
+  if (fread(mp->data, 1, mp->len, ifp) != mp->len) {
+    free(mp->data);
+    fclose(ifp);
+    return 0;
+  }
+
+  fclose(ifp);
+  return 1;
+
+} /* end read_file() */
+
+int map_file(char *path, mapping *mp) {
+#ifdef USE_MMAP
+  struct stat st;
+  void *addr;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return 0;
+
+  /* An empty file cannot be mapped, so it is read instead */
+  if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+      (addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) !=
+          MAP_FAILED) {
+    close(fd);
+
+    mp->data = addr;
+    mp->len = (size_t)st.st_size;
+    mp->mapped = 1;
+
+    return 1;
+  }
+
+  close(fd);
+#endif
+
+  return read_file(path, mp);
+
+} /* end map_file() */
+
+void unmap_file(mapping *mp) {
+#ifdef USE_MMAP
+  if (mp->mapped) {
+    munmap(mp->data, mp->len);
+    mp->data = NULL;
+    return;
+  }
+#endif
+
+  free(mp->data);
+  mp->data = NULL;
+
+} /* end unmap_file() */
+
+/* Here there be dragons */
@@ -0,0 +1,29 @@
+/*
+  mapfile.h
+
+  Reading a whole file into memory, by mapping it where that is
+  possible, for tt2rom version 2.
+ */
+
+#ifndef _H_MAPFILE_
+#define _H_MAPFILE_
+
+#include <stddef.h>
+
+/* The contents of a file, as returned by map_file() */
+typedef struct {
+  unsigned char *data; /* the bytes of the file           */
+  size_t len;          /* how many there are              */
+  int mapped;          /* mapped, rather than read in?    */
+} mapping;
+
+/* Make the contents of the named file available at 'mp->data', for
+   reading only.  Returns false if the file could not be read, or
+   memory could not be had.
+ */
+int map_file(char *path, mapping *mp);
+
+/* Release the contents of a file got by map_file() */
+void unmap_file(mapping *mp);
+
+#endif /* end _H_MAPFILE_ */
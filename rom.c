@@ -12,14 +12,52 @@
 #include <ctype.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 /* Get bits 16-19 out of the given address, and left-justify */
-#define SEGMENT(A) (((A >> 16) & 0xF) << 12)
+#define SEGMENT(A) ((((A) >> 16) & 0xF) << 12)
+
+#define OBUF_SIZE 32768 /* output buffer size for the encoders  */
+#define MAX_RECORD 600  /* longest record we ever write (bytes) */
+
+/* Records are built in a large buffer which is written out in big
+   blocks, rather than a few bytes at a time through fprintf()
+ */
+typedef struct {
+  char buf[OBUF_SIZE];
+  int len;
+  sink_func put; /* where full buffers go   */
+  void *arg;     /* passed along to put()   */
+  int ok;        /* has put() always worked */
+} outbuf;
+
+static void flush_outbuf(outbuf *ob);
+
+static const char s_hexdigit[] = "0123456789ABCDEF";
+
+/* Write byte 'v' as two hex digits at 'out', returning the new end */
+#define PUT_HEX(out, v)                      \
+  ((out)[0] = s_hexdigit[((v) >> 4) & 0xF], \
+   (out)[1] = s_hexdigit[(v)&0xF], (out) + 2)
+
+/* Write the low 'n' hex digits of 'v' at 'out', returning the new end */
+static char *put_digits(char *out, address v, int n);
+
+/* A sink that writes to the file given as its argument */
+static int file_sink(void *arg, char *buf, size_t len);
 
 /* Write individual records out to a file */
-static void write_data_record(byte *data, int len, address addr, FILE *ofp);
-static void write_offset_record(address offset, FILE *ofp);
-static void write_end_record(FILE *ofp);
+static void write_data_record(byte *data, int len, address addr, outbuf *ob);
+static void write_offset_record(address offset, outbuf *ob);
+static void write_linear_record(address upper, outbuf *ob);
+static void write_end_record(outbuf *ob);
+static void write_srec_record(int type, int abytes, address addr, byte *data,
+                              int len, outbuf *ob);
 
 /* The checksum used by the Intel ROM programmer is the two's
    complement of the sum of the bytes of the data being checked.
@@ -66,26 +104,312 @@ byte compute_offset_checksum(address offset) {
 
 } /* end of compute_offset_checksum() */
 
+byte compute_linear_checksum(address upper) {
+  unsigned int sum = 2; /* size of linear address record */
+
+  sum += (upper >> CHAR_BIT) & UCHAR_MAX;
+  sum += upper & UCHAR_MAX;
+  sum += LINEAR_REC;
+
+  return ~(sum & UCHAR_MAX) + 1;
+
+} /* end of compute_linear_checksum() */
+
 byte compute_end_checksum(void) { return ~END_REC + 1; }
 
+/* Bytes of storage in each page of an image */
+#define PAGE_SIZE(I) (((size_t)1 << (I)->pbits) * (I)->width)
+
+image *new_image(int abits, int width, byte fill) {
+  image *img;
+
+  if ((img = malloc(sizeof(image))) == NULL) return NULL;
+
+  img->map = NULL;
+  img->abits = abits;
+  img->width = width;
+  img->pbits = (abits < PAGE_BITS) ? abits : PAGE_BITS;
+  img->fill = fill;
+  img->npages = (address)1 << (abits - img->pbits);
+  img->page = calloc(img->npages, sizeof(byte *));
+  img->blank = malloc(PAGE_SIZE(img));
+
+  if (img->page == NULL || img->blank == NULL) {
+    free_image(img);
+    return NULL;
+  }
+  memset(img->blank, fill, PAGE_SIZE(img));
+
+  return img;
+
+} /* end of new_image() */
+
+#ifdef USE_MMAP
+/*
+  The file is sized with ftruncate(), so pages never written are holes
+  that read as zero, and take no space unless the fill value is not.
+  Where the system offers it, the kernel is asked to back the mapping
+  with huge pages, to spare TLB misses over a large image.
+ */
+image *map_image(char *path, int abits, int width, byte fill) {
+  image *img;
+  size_t len;
+  void *addr;
+  int fd;
+
+  /* The whole file must fit in the address space */
+  if (abits >= (int)(sizeof(size_t) * CHAR_BIT) ||
+      ((size_t)1 << abits) > (size_t)-1 / width)
+    return NULL;
+  len = ((size_t)1 << abits) * width;
+
+  if ((img = new_image(abits, width, fill)) == NULL) return NULL;
+
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+    free_image(img);
+    return NULL;
+  }
+
+  if (ftruncate(fd, (off_t)len) != 0 ||
+      (addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+          MAP_FAILED) {
+    close(fd);
+    free_image(img);
+    return NULL;
+  }
+  close(fd);
+
+#ifdef MADV_HUGEPAGE
+  madvise(addr, len, MADV_HUGEPAGE);
+#endif
+
+  img->map = addr;
+  return img;
+
+} /* end of map_image() */
+#endif /* USE_MMAP */
+
+int sync_image(image *img) {
+#ifdef USE_MMAP
+  address pnum;
+
+  if (img->map == NULL) return 1;
+
+  for (pnum = 0; pnum < img->npages; pnum++)
+    if (img->page[pnum] == NULL && img->fill != 0) image_page(img, pnum);
+
+  return msync(img->map, (size_t)img->npages * PAGE_SIZE(img), MS_ASYNC) == 0;
+#else
+  return 1;
+#endif
+
+} /* end of sync_image() */
+
+void free_image(image *img) {
+  address pnum;
+
+  if (img == NULL) return;
+
+#ifdef USE_MMAP
+  if (img->map) {
+    munmap(img->map, (size_t)img->npages * PAGE_SIZE(img));
+    img->map = NULL;
+
+    /* The pages were all in the mapping */
+    for (pnum = 0; pnum < img->npages; pnum++) img->page[pnum] = NULL;
+  }
+#endif
+
+  if (img->page) {
+    for (pnum = 0; pnum < img->npages; pnum++)
+      if (img->page[pnum]) free(img->page[pnum]);
+
+    free(img->page);
+  }
+  if (img->blank) free(img->blank);
+
+  free(img);
+
+} /* end of free_image() */
+
+double image_size(image *img) {
+  double size = (double)img->npages * sizeof(byte *) + PAGE_SIZE(img);
+  address pnum;
+
+  for (pnum = 0; pnum < img->npages; pnum++)
+    if (img->page[pnum]) size += PAGE_SIZE(img);
+
+  return size;
+
+} /* end of image_size() */
+
+byte *image_page(image *img, address pnum) {
+  byte *page = img->page[pnum];
+
+  if (page == NULL) {
+    if (img->map) {
+      /* A new page of a file is zero already */
+      page = img->map + pnum * PAGE_SIZE(img);
+      if (img->fill != 0) memcpy(page, img->blank, PAGE_SIZE(img));
+
+    } else if ((page = malloc(PAGE_SIZE(img))) == NULL) {
+      return NULL;
+
+    } else {
+      memcpy(page, img->blank, PAGE_SIZE(img));
+    }
+
+    img->page[pnum] = page;
+  }
+
+  return page;
+
+} /* end of image_page() */
+
+void release_pages(image *img, address first, address count) {
+  address pnum;
+
+  if (img->map) return;
+
+  for (pnum = first; pnum < first + count; pnum++) {
+    if (img->page[pnum]) {
+      free(img->page[pnum]);
+      img->page[pnum] = NULL;
+    }
+  }
+
+} /* end of release_pages() */
+
+byte image_read(image *img, address addr, int lane) {
+  byte *page = img->page[addr >> img->pbits];
+
+  if (page == NULL) return img->fill;
+
+  return page[(addr & LOW_BITS(img->pbits)) * img->width + lane];
+
+} /* end of image_read() */
+
+/* Splitting an interleaved page into planes is a strided gather,
+   which is simple enough for the compiler to vectorise
+ */
+byte *image_plane(image *img, int lane, address pnum, byte *buf) {
+  byte *page = PAGE_DATA(img, pnum) + lane;
+  int ix, width = img->width, count = 1 << img->pbits;
+
+  if (width == 1) return page;
+
+  for (ix = 0; ix < count; ix++) buf[ix] = page[ix * width];
+
+  return buf;
+
+} /* end of image_plane() */
+
+byte *image_lanes(image *img, int lane, int count, int rev, address pnum,
+                  byte *buf) {
+  byte *page = PAGE_DATA(img, pnum) + lane;
+  int ix, jx, width = img->width, nlocs = 1 << img->pbits;
+
+  if (count == width && !rev) return page;
+  if (count == 1) return image_plane(img, lane, pnum, buf);
+
+  for (ix = 0; ix < nlocs; ix++, page += width) {
+    byte *out = buf + ix * count;
+
+    if (rev)
+      for (jx = 0; jx < count; jx++) out[jx] = page[count - 1 - jx];
+    else
+      for (jx = 0; jx < count; jx++) out[jx] = page[jx];
+  }
+
+  return buf;
+
+} /* end of image_lanes() */
+
+/*
+  A page of words is 'count' pages' worth of bytes in the new image,
+  or part of one page of it, if the image is less than a page big.
+ */
+image *unpack_words(image *img, int lane, int count, int rev) {
+  size_t psize = (size_t)count << img->pbits;
+  address pnum, addr;
+  byte *buf, *data, *page;
+  image *out;
+  int shift = 0;
+  size_t done, len;
+
+  while ((1 << shift) < count) ++shift;
+
+  if ((out = new_image(img->abits + shift, 1, img->fill)) == NULL) return NULL;
+
+  if ((buf = malloc(psize)) == NULL) {
+    free_image(out);
+    return NULL;
+  }
+
+  for (pnum = 0; pnum < img->npages; pnum++) {
+    if (img->page[pnum] == NULL) continue;
+
+    data = image_lanes(img, lane, count, rev, pnum, buf);
+    addr = (address)psize * pnum;
+
+    for (done = 0; done < psize; done += len, addr += len) {
+      len = ((size_t)1 << out->pbits) - (addr & LOW_BITS(out->pbits));
+      if (len > psize - done) len = psize - done;
+
+      if ((page = image_page(out, addr >> out->pbits)) == NULL) {
+        free(buf);
+        free_image(out);
+        return NULL;
+      }
+      memcpy(page + (addr & LOW_BITS(out->pbits)), data + done, len);
+    }
+  }
+
+  free(buf);
+
+  return out;
+
+} /* end of unpack_words() */
+
+#ifdef REFERENCE
+
+/* Write a single location of an image; returns false if the page
+   holding it could not be allocated
+ */
+static int image_write(image *img, address addr, byte val) {
+  byte *page = image_page(img, addr >> img->pbits);
+
+  if (page == NULL) return 0;
+
+  page[addr & LOW_BITS(img->pbits)] = val;
+  return 1;
+
+} /* end of image_write() */
+
+#endif /* REFERENCE */
+
 /* Using 'addr' as a base address, possibly including "don't care"
    designators, write byte value 'val' to all the memory addresses
-   indicated by the address itself.  The ROM image is presumed to have
-   enough storage available for this to work.
+   indicated by the address itself.  Returns true if successful, false
+   if memory for the image could not be had.
 
    The 'addr' parameter is a string of '0', '1', and 'x' characters
    denoting the address to be considered.  An 'x' denotes a don't care
    value.  The 'alen' parameter is the length of the address, which is
    not presumed to be zero-terminated.
 
-   This algorithm stolen from the original tt2rom by Anthony Edwards
+   This algorithm stolen from the original tt2rom by Anthony Edwards.
+   It is retained only if REFERENCE is defined at compile time, so its
+   output may be compared with that of write_cube(), which is used
+   otherwise.
  */
-void write_range(byte *rom, char *addr, int alen, byte val) {
+#ifdef REFERENCE
+int write_range(image *img, char *addr, int alen, byte val) {
   char *wild; /* array indicating positions of don't-care bits */
   int ix, jx, kx, count = 0;
-  address base = 0;
+  address base = 0, ctr, last;
 
-  if ((wild = calloc(alen, sizeof(char))) == NULL) return;
+  if ((wild = calloc(alen, sizeof(char))) == NULL) return 0;
 
   /* Construct base address with all don't-care bits set to zero */
   for (ix = 0; ix < alen; ix++) {
@@ -109,128 +433,1009 @@ void write_range(byte *rom, char *addr, int alen, byte val) {
      zeroes in the "don't care" positions, so we can just add the
      offset to the base to get the effective address.
    */
-  count = (1 << count);
+  last = LOW_BITS(count);
+  ctr = 0;
 
-  for (ix = 0; ix < count; ix++) {
+  do {
     address off = 0; /* offset from base address */
 
     /*  Construct the offset for the next counter value */
     for (jx = 0, kx = 0; jx < alen; jx++) {
       off <<= 1;
 
-      if (wild[jx]) off |= (ix >> kx++) & 1;
+      if (wild[jx]) off |= (ctr >> kx++) & 1;
     }
 
     /*  Write the byte value to this location in the ROM image */
-    *(rom + base + off) = val;
-  }
+    if (!image_write(img, base + off, val)) {
+      free(wild);
+      return 0;
+    }
+  } while (ctr++ != last);
 
   free(wild);
+  return 1;
 
 } /* end of write_range() */
 
-void dump_raw(byte *rom, int rlen, FILE *ofp) {
-  fwrite(rom, sizeof(byte), rlen, ofp);
+/* The reference version of write_cube() uses the same algorithm: a
+   binary counter whose bits are moved, one at a time, to the
+   positions of the don't-care bits in the mask.
+ */
+int write_cube(image *img, address base, address mask, byte val) {
+  address ctr = 0, last, bit;
+  int kx = 0;
+
+  for (bit = mask; bit != 0; bit &= bit - 1) ++kx;
+  last = LOW_BITS(kx);
 
-} /* end of dump_raw() */
+  do {
+    address off = 0; /* offset from base address */
+
+    for (bit = 1, kx = 0; bit != 0 && bit <= mask; bit <<= 1) {
+      if (mask & bit) off |= ((ctr >> kx++) & 1) ? bit : 0;
+    }
+
+    if (!image_write(img, base + off, val)) return 0;
+  } while (ctr++ != last);
+
+  return 1;
+
+} /* end of write_cube() */
+
+#else /* !REFERENCE */
+
+int write_range(image *img, char *addr, int alen, byte val) {
+  address base, mask;
+
+  compile_range(addr, alen, &base, &mask);
+  return write_cube(img, base, mask, val);
+
+} /* end of write_range() */
+
+/* Rather than rebuilding each offset bit by bit, we enumerate the
+   subsets of the don't-care mask directly: given one subset 'sub' of
+   'mask', the next one in binary counting order is (sub - mask) & mask,
+   and the sequence returns to zero after the last.  Since the base
+   address has zeroes in all the don't-care positions, OR-ing in each
+   subset yields each address in the cube.
+
+   Don't-care bits at the low-order end of the address describe a run
+   of consecutive locations, so those are split off and written with
+   memset(), a page at a time, and only the remaining high-order bits
+   are enumerated.
+ */
+int write_cube(image *img, address base, address mask, byte val) {
+  address run = mask & ~(mask + 1); /* contiguous low-order don't-cares */
+  address high = mask & ~run;       /* the rest of the don't-care bits  */
+  address sub = 0, pmask = LOW_BITS(img->pbits);
+  int pbits = img->pbits;
+  byte *page;
+
+  if (run == 0) {
+    do {
+      address addr = base | sub;
+
+      if ((page = img->page[addr >> pbits]) == NULL &&
+          (page = image_page(img, addr >> pbits)) == NULL)
+        return 0;
+
+      page[addr & pmask] = val;
+      sub = (sub - high) & high;
+    } while (sub != 0);
+  } else {
+    do {
+      address first = base | sub, last = first + run; /* inclusive */
+      address pnum;
+
+      for (pnum = first >> pbits; pnum <= last >> pbits; pnum++) {
+        address lo = (pnum == first >> pbits) ? (first & pmask) : 0;
+        address hi = (pnum == last >> pbits) ? (last & pmask) : pmask;
+
+        if ((page = image_page(img, pnum)) == NULL) return 0;
+
+        memset(page + lo, val, hi - lo + 1);
+      }
+      sub = (sub - high) & high;
+    } while (sub != 0);
+  }
+
+  return 1;
+
+} /* end of write_cube() */
+
+#endif /* REFERENCE */
+
+/* Like write_cube(), except that each location gets a whole word.  A
+   run of consecutive locations is filled by copying the first word,
+   then doubling the filled part with each copy after that.
+ */
+int write_words(image *img, address base, address mask, byte *vals) {
+  address run = mask & ~(mask + 1);
+  address high = mask & ~run;
+  address sub = 0, pmask = LOW_BITS(img->pbits);
+  int pbits = img->pbits, width = img->width;
+  byte *page;
+
+  if (width == 1) return write_cube(img, base, mask, vals[0]);
 
-void dump_text(byte *rom, int rlen, FILE *ofp) {
-  int pos, brk = 0;
+  if (run == 0) {
+    do {
+      address addr = base | sub;
+      byte *out;
+      int ix;
 
-  for (pos = 0; pos < rlen; pos++) {
-    if (brk == 0) fprintf(ofp, "%05X:", pos);
+      if ((page = img->page[addr >> pbits]) == NULL &&
+          (page = image_page(img, addr >> pbits)) == NULL)
+        return 0;
 
-    fprintf(ofp, " %02X", rom[pos]);
+      out = page + (addr & pmask) * width;
+      for (ix = 0; ix < width; ix++) out[ix] = vals[ix];
 
-    brk = (brk + 1) & 15;
-    if (brk == 0) fputc('\n', ofp);
+      sub = (sub - high) & high;
+    } while (sub != 0);
+
+    return 1;
+  }
+
+  do {
+    address first = base | sub, last = first + run; /* inclusive */
+    address pnum;
+
+    for (pnum = first >> pbits; pnum <= last >> pbits; pnum++) {
+      address lo = (pnum == first >> pbits) ? (first & pmask) : 0;
+      address hi = (pnum == last >> pbits) ? (last & pmask) : pmask;
+      size_t len = (hi - lo + 1) * width, done = width;
+      byte *out;
+
+      if ((page = image_page(img, pnum)) == NULL) return 0;
+
+      out = page + lo * width;
+      memcpy(out, vals, width);
+
+      while (done < len) {
+        size_t chunk = (done < len - done) ? done : len - done;
+
+        memcpy(out + done, out, chunk);
+        done += chunk;
+      }
+    }
+    sub = (sub - high) & high;
+  } while (sub != 0);
+
+  return 1;
+
+} /* end of write_words() */
+
+void compile_range(char *addr, int alen, address *base, address *mask) {
+  address b = 0, m = 0;
+  int ix;
+
+  for (ix = 0; ix < alen; ix++) {
+    b <<= 1;
+    m <<= 1;
+
+    if (addr[ix] == '1')
+      b |= 1;
+    else if (tolower((int)addr[ix]) == 'x')
+      m |= 1;
   }
-  if (brk != 0) fputc('\n', ofp);
+
+  *base = b;
+  *mask = m;
+
+} /* end of compile_range() */
+
+/* Two cubes intersect unless some bit is fixed in both and the fixed
+   values differ.  The base of each cube is zero in its don't-care
+   positions, so the base of the intersection is just the union of the
+   two bases.
+ */
+int cube_intersect(address b1, address m1, address b2, address m2,
+                   address *base, address *mask) {
+  if (((b1 ^ b2) & ~(m1 | m2)) != 0) return 0;
+
+  *base = b1 | b2;
+  *mask = m1 & m2;
+  return 1;
+
+} /* end of cube_intersect() */
+
+void dump_raw(image *img, int lane, FILE *ofp) {
+  encode_raw(img, lane, file_sink, ofp);
+
+} /* end of dump_raw() */
+
+void dump_text(image *img, int lane, FILE *ofp) {
+  encode_text(img, lane, file_sink, ofp);
 
 } /* end of dump_text() */
 
-void dump_intel(byte *rom, int rlen, FILE *ofp) {
-  address cur = 0, seg = 0;
+void dump_intel(image *img, int lane, FILE *ofp) {
+  encode_intel(img, lane, file_sink, ofp);
+
+} /* end of dump_intel() */
+
+void dump_image(image *img, int lane, int fmt, encoding *en, FILE *ofp) {
+  encode_image(img, lane, fmt, en, file_sink, ofp);
+
+} /* end of dump_image() */
+
+static int file_sink(void *arg, char *buf, size_t len) {
+  return fwrite(buf, sizeof(char), len, (FILE *)arg) == len;
+
+} /* end file_sink() */
+
+/* An encoder in progress; see start_encoding() */
+struct encoder {
+  image *img;
+  int lane;
+  int fmt;
+  int sparse;    /* skip unwritten pages?                 */
+  int reclen;    /* Intel, S-records: bytes per record    */
+  int blank;     /* value of locations left out           */
+  int wbytes;    /* lanes in each word                    */
+  int big;       /* most significant byte first?          */
+  int unit;      /* bytes per entry of a hex dump line    */
+  int bbits;     /* bits in the byte address of the output */
+  int psize;     /* bytes of output per page of the image */
+  byte *plane;   /* a page of words, gathered             */
+  address seg;   /* Intel: segment or upper address       */
+  int brk;       /* bytes on the current line             */
+  address next;  /* TI-TXT, Verilog: address of next byte */
+  int digits;    /* hex digits in an address              */
+  address count; /* S-records: data records written       */
+  outbuf ob;
+};
+
+/* Formats that give the address of their data, and so may leave out
+   the pages of a sparse image that were never written
+ */
+#define ADDRESSED(F) \
+  ((F) == INTEL_ENC || (F) == SREC_ENC || (F) == TITXT_ENC || (F) == VMEM_ENC)
+
+/* Bytes of address in an S-record for an image of 'n' address bits */
+#define SREC_ABYTES(n) ((n) <= 16 ? 2 : (n) <= 24 ? 3 : 4)
+
+void default_encoding(encoding *en) {
+  en->reclen = CHUNK_SIZE;
+  en->blank = NO_BLANK;
+  en->wbytes = 1;
+  en->big = 0;
+
+} /* end of default_encoding() */
+
+/*
+  The lanes of a word are gathered into a page of their own, in the
+  order they are written.  A $readmemh word is one entry, written most
+  significant digit first whatever the byte order.
+ */
+encoder *start_encoding(image *img, int lane, int fmt, encoding *en,
+                        sink_func put, void *arg) {
+  encoding def;
+  encoder *ep;
+
+  if (en == NULL) {
+    default_encoding(&def);
+    en = &def;
+  }
+
+  if ((ep = malloc(sizeof(encoder))) == NULL) return NULL;
+
+  ep->wbytes = (en->wbytes > 1) ? en->wbytes : 1;
+  ep->psize = ep->wbytes << img->pbits;
+
+  if ((ep->plane = malloc(ep->psize)) == NULL) {
+    free(ep);
+    return NULL;
+  }
 
-  /* Begin by priming the segment register */
-  write_offset_record(seg, ofp);
+  ep->img = img;
+  ep->lane = lane;
+  ep->fmt = fmt;
+  ep->big = en->big || fmt == VMEM_ENC;
+  ep->unit = (fmt == VMEM_ENC) ? ep->wbytes : 1;
+  for (ep->bbits = img->abits; (1 << (ep->bbits - img->abits)) < ep->wbytes;)
+    ++ep->bbits;
+  ep->sparse = (ep->bbits > DENSE_BITS && ADDRESSED(fmt));
+  ep->reclen = (en->reclen < 1)            ? 1
+               : (en->reclen > MAX_RECLEN) ? MAX_RECLEN
+                                           : en->reclen;
+  ep->blank = ADDRESSED(fmt) ? en->blank : NO_BLANK;
+  ep->brk = 0;
+  ep->next = ~(address)0;
+  ep->digits = (fmt == VMEM_ENC) ? img->abits : ep->bbits;
+  ep->digits = (ep->digits > 16) ? (ep->digits + 3) / 4 : 4;
+  ep->count = 0;
+  ep->ob.len = 0;
+  ep->ob.put = put;
+  ep->ob.arg = arg;
+  ep->ob.ok = 1;
 
-  /* Write out data records in CHUNK_SIZE blocks, until the whole ROM
-     has been written, or a smaller chunk remains
+  /* Begin an Intel file by priming the segment register; for a sparse
+     image, this happens when the first page is written
    */
-  while (cur + CHUNK_SIZE <= rlen) {
-    /* If the segment register has changed, update it, and issue a new
-       offset record
+  if (fmt == INTEL_ENC) {
+    if (ep->sparse) {
+      ep->seg = ~(address)0;
+    } else {
+      ep->seg = 0;
+      write_offset_record(ep->seg, &ep->ob);
+    }
+  }
+
+  /* An S-record file begins with an empty header record */
+  if (fmt == SREC_ENC) write_srec_record(0, 2, 0, NULL, 0, &ep->ob);
+
+  if (fmt == CARRAY_ENC)
+    ep->ob.len = sprintf(ep->ob.buf,
+                         "/* ROM image written by tt2rom, %d address bits "
+                         "*/\n#ifndef ROM_NAME\n#define ROM_NAME rom_image\n"
+                         "#endif\n\nconst unsigned char ROM_NAME[] = {\n",
+                         img->abits);
+
+  return ep;
+
+} /* end of start_encoding() */
+
+/* Raw pages are handed straight to the sink, without copying */
+static void raw_page(encoder *ep, byte *data, address pnum) {
+  flush_outbuf(&ep->ob);
+
+  if (ep->ob.ok) ep->ob.ok = ep->ob.put(ep->ob.arg, (char *)data, ep->psize);
+
+} /* end of raw_page() */
+
+static void text_page(encoder *ep, byte *data, address pnum) {
+  int ix, psize = ep->psize;
+  int width = (ep->bbits > DENSE_BITS) ? 8 : 5; /* address digits */
+  address pos = (address)psize * pnum;
+  outbuf *ob = &ep->ob;
+  char *out;
+
+  for (ix = 0; ix < psize; ix++, pos++) {
+    if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+    out = ob->buf + ob->len;
+
+    if (ep->brk == 0) {
+      out = put_digits(out, pos, width);
+      *out++ = ':';
+    }
+
+    *out++ = ' ';
+    out = PUT_HEX(out, data[ix]);
+
+    ep->brk = (ep->brk + 1) % LINE_BYTES;
+    if (ep->brk == 0) *out++ = '\n';
+
+    ob->len = out - ob->buf;
+  }
+
+} /* end of text_page() */
+
+/* The length of the run of bytes equal to 'val' at the start of
+   'data', up to 'len'.  While they match, whole words are compared at
+   a time, so long runs of blanks are passed over quickly.
+ */
+static int blank_run(byte *data, int len, int val) {
+  unsigned long pat = (unsigned long)val * (~0UL / UCHAR_MAX), word;
+  int ix = 0;
+
+  while (ix + (int)sizeof(word) <= len) {
+    memcpy(&word, data + ix, sizeof(word));
+    if (word != pat) break;
+    ix += sizeof(word);
+  }
+
+  while (ix < len && data[ix] == val) ++ix;
+
+  return ix;
+
+} /* end of blank_run() */
+
+/* Find the next record of a page of 'psize' bytes, from offset '*off'
+   on, for the formats written as records.  A run of at least MIN_GAP
+   blanks there is skipped, moving '*off' past it.  The record is at
+   most 'maxlen' bytes, and stops short of the next such run.  Returns
+   its length, or 0 if there is nothing left in the page.
+ */
+static int next_record(encoder *ep, byte *data, int *off, int psize,
+                       int maxlen) {
+  int ix, len, run;
+
+  if (*off < psize && data[*off] == ep->blank &&
+      (run = blank_run(data + *off, psize - *off, ep->blank)) >= MIN_GAP)
+    *off += run;
+
+  if (*off >= psize) return 0;
+
+  len = (psize - *off < maxlen) ? psize - *off : maxlen;
+  if (ep->blank == NO_BLANK) return len;
+
+  for (ix = 1; ix < len; ix++) {
+    if (data[*off + ix] != ep->blank) continue;
+
+    run = blank_run(data + *off + ix, psize - *off - ix, ep->blank);
+    if (run >= MIN_GAP) return ix;
+
+    ix += run - 1;
+  }
+
+  return len;
+
+} /* end of next_record() */
+
+/* S-records are written as Intel records are, but each carries its
+   whole address, so no other records are needed
+ */
+static void srec_page(encoder *ep, byte *data, address pnum) {
+  int off, len, psize = ep->psize;
+  address cur = (address)psize * pnum;
+  int abytes = SREC_ABYTES(ep->bbits);
+  int maxlen = (ep->reclen > MAX_RECLEN - abytes - 1) ? MAX_RECLEN - abytes - 1
+                                                       : ep->reclen;
+
+  for (off = 0; (len = next_record(ep, data, &off, psize, maxlen)) > 0;
+       off += len) {
+    write_srec_record(abytes - 1, abytes, cur + off, data + off, len, &ep->ob);
+    ++ep->count;
+  }
+
+} /* end of srec_page() */
+
+/* TI-TXT and $readmemh files are hex entries of 'unit' bytes, making
+   up LINE_BYTES to a line, with an '@' line giving the address (in
+   entries) wherever a run of data begins
+ */
+static void hex_page(encoder *ep, byte *data, address pnum) {
+  int ix, jx, run, keep = 0, psize = ep->psize, unit = ep->unit;
+  int per_line = (unit < LINE_BYTES) ? LINE_BYTES / unit : 1;
+  address pos = (address)(psize / unit) * pnum;
+  outbuf *ob = &ep->ob;
+  char *out;
+
+  for (ix = 0; ix < psize; ix += unit, pos++) {
+    /* Leave out long runs of blank entries, noting the length of short
+       ones so that they are not measured again
      */
-    if (SEGMENT(cur) != seg) {
-      seg = SEGMENT(cur);
-      write_offset_record(seg, ofp);
+    if (ix >= keep && data[ix] == ep->blank) {
+      run = blank_run(data + ix, psize - ix, ep->blank) / unit;
+
+      if (run >= MIN_GAP) {
+        ix += (run - 1) * unit;
+        pos += run - 1;
+        continue;
+      }
+      keep = ix + run * unit;
+    }
+
+    if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+    out = ob->buf + ob->len;
+
+    if (pos != ep->next) {
+      if (ep->brk != 0) *out++ = '\n';
+      *out++ = '@';
+      out = put_digits(out, pos, ep->digits);
+      *out++ = '\n';
+      ep->brk = 0;
     }
 
-    write_data_record(rom + cur, CHUNK_SIZE, cur & 0xFFFF, ofp);
-    cur += CHUNK_SIZE;
+    if (ep->brk != 0) *out++ = ' ';
+    for (jx = 0; jx < unit; jx++) out = PUT_HEX(out, data[ix + jx]);
+
+    ep->brk = (ep->brk + 1) % per_line;
+    if (ep->brk == 0) *out++ = '\n';
+
+    ob->len = out - ob->buf;
+    ep->next = pos + 1;
+  }
+
+} /* end of hex_page() */
+
+static void carray_page(encoder *ep, byte *data, address pnum) {
+  int ix, psize = ep->psize;
+  outbuf *ob = &ep->ob;
+  char *out;
+
+  for (ix = 0; ix < psize; ix++) {
+    if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+    out = ob->buf + ob->len;
+
+    if (ep->brk == 0) *out++ = ' ';
+    *out++ = ' ';
+    *out++ = '0';
+    *out++ = 'x';
+    out = PUT_HEX(out, data[ix]);
+    *out++ = ',';
+
+    ep->brk = (ep->brk + 1) % LINE_BYTES;
+    if (ep->brk == 0) *out++ = '\n';
+
+    ob->len = out - ob->buf;
   }
 
-  /* If there's a small block at the end, write it out now ... */
-  if (cur < rlen) {
-    if (SEGMENT(cur) != seg) {
-      seg = SEGMENT(cur);
-      write_offset_record(seg, ofp);
+} /* end of carray_page() */
+
+/* The image is written a page at a time, in records of up to 'reclen'
+   bytes (or the whole page, if the image is smaller than that), none
+   of which crosses a page.  A segment is a whole number of pages.  The
+   segment or upper address is set just before the data record that
+   needs it, so pages and runs of blanks that are left out issue none.
+ */
+static void intel_page(encoder *ep, byte *data, address pnum) {
+  int off, len, psize = ep->psize;
+  address cur = (address)psize * pnum;
+
+  for (off = 0; (len = next_record(ep, data, &off, psize, ep->reclen)) > 0;
+       off += len) {
+    /* When the upper 16 bits of the address of a sparse image change,
+       issue a new linear address record; otherwise, if the segment
+       register has changed, update it, and issue a new offset record
+     */
+    if (ep->sparse) {
+      if (((cur + off) >> 16) != ep->seg) {
+        ep->seg = (cur + off) >> 16;
+        write_linear_record(ep->seg, &ep->ob);
+      }
+    } else if (SEGMENT(cur + off) != ep->seg) {
+      ep->seg = SEGMENT(cur + off);
+      write_offset_record(ep->seg, &ep->ob);
     }
 
-    write_data_record(rom + cur, rlen - cur, cur & 0xFFFF, ofp);
+    write_data_record(data + off, len, (cur + off) & 0xFFFF, &ep->ob);
   }
 
-  /* Conclude with an end record ... */
-  write_end_record(ofp);
+} /* end of intel_page() */
 
-} /* end of dump_intel() */
+int encode_pages(encoder *ep, address first, address count) {
+  address pnum;
+
+  for (pnum = first; pnum < first + count && ep->ob.ok; pnum++) {
+    byte *data;
+
+    /* Unwritten pages hold only the fill value.  They are left out if
+       that is the blank value, or if there is none and the image is
+       sparse; otherwise, any runs of blanks in them are found below.
+     */
+    if (ep->img->page[pnum] == NULL &&
+        (ep->blank == ep->img->fill || (ep->blank == NO_BLANK && ep->sparse)))
+      continue;
+
+    data = image_lanes(ep->img, ep->lane, ep->wbytes, ep->big, pnum,
+                       ep->plane);
+
+    switch (ep->fmt) {
+      case RAW_ENC:
+        raw_page(ep, data, pnum);
+        break;
+      case TEXT_ENC:
+        text_page(ep, data, pnum);
+        break;
+      case SREC_ENC:
+        srec_page(ep, data, pnum);
+        break;
+      case TITXT_ENC:
+      case VMEM_ENC:
+        hex_page(ep, data, pnum);
+        break;
+      case CARRAY_ENC:
+        carray_page(ep, data, pnum);
+        break;
+      default:
+        intel_page(ep, data, pnum);
+        break;
+    }
+  }
+
+  return ep->ob.ok;
+
+} /* end of encode_pages() */
+
+int finish_encoding(encoder *ep) {
+  int ok;
+
+  /* Conclude a text file with a newline, and an Intel file with an
+     end record.  An S-record file ends with a count of its data
+     records, if that fits in three bytes, and a termination record;
+     a TI-TXT file with a 'q', and a C array with its closing brace.
+   */
+  if (ep->brk != 0) ep->ob.buf[ep->ob.len++] = '\n';
+
+  if (ep->ob.len + MAX_RECORD > OBUF_SIZE) flush_outbuf(&ep->ob);
+
+  switch (ep->fmt) {
+    case INTEL_ENC:
+      write_end_record(&ep->ob);
+      break;
+    case SREC_ENC:
+      if (ep->count <= 0xFFFF)
+        write_srec_record(5, 2, ep->count, NULL, 0, &ep->ob);
+      else if (ep->count <= 0xFFFFFF)
+        write_srec_record(6, 3, ep->count, NULL, 0, &ep->ob);
+      write_srec_record(11 - SREC_ABYTES(ep->bbits), SREC_ABYTES(ep->bbits), 0,
+                        NULL, 0, &ep->ob);
+      break;
+    case TITXT_ENC:
+      ep->ob.len += sprintf(ep->ob.buf + ep->ob.len, "q\n");
+      break;
+    case CARRAY_ENC:
+      ep->ob.len += sprintf(ep->ob.buf + ep->ob.len, "};\n\n#undef ROM_NAME\n");
+      break;
+  }
+
+  flush_outbuf(&ep->ob);
+
+  ok = ep->ob.ok;
+  free(ep->plane);
+  free(ep);
+
+  return ok;
+
+} /* end of finish_encoding() */
+
+/* Encode a whole image at once */
+static int encode_all(image *img, int lane, int fmt, encoding *en,
+                      sink_func put, void *arg) {
+  encoder *ep = start_encoding(img, lane, fmt, en, put, arg);
+
+  if (ep == NULL) return 0;
+
+  encode_pages(ep, 0, img->npages);
+
+  return finish_encoding(ep);
+
+} /* end of encode_all() */
+
+int encode_raw(image *img, int lane, sink_func put, void *arg) {
+  return encode_all(img, lane, RAW_ENC, NULL, put, arg);
+
+} /* end of encode_raw() */
+
+int encode_text(image *img, int lane, sink_func put, void *arg) {
+  return encode_all(img, lane, TEXT_ENC, NULL, put, arg);
+
+} /* end of encode_text() */
+
+int encode_intel(image *img, int lane, sink_func put, void *arg) {
+  return encode_all(img, lane, INTEL_ENC, NULL, put, arg);
+
+} /* end of encode_intel() */
+
+int encode_image(image *img, int lane, int fmt, encoding *en, sink_func put,
+                 void *arg) {
+  if (fmt < RAW_ENC || fmt > NUM_ENC) return 0;
+
+  return encode_all(img, lane, fmt, en, put, arg);
+
+} /* end of encode_image() */
+
+/* Value of a hexadecimal digit, or -1 if 'c' is not one */
+static int hex_value(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+
+  return -1;
+
+} /* end hex_value() */
+
+int read_intel(image *img, FILE *ifp, int *line) {
+  char buf[MAX_RECORD];
+  byte rec[MAX_RECORD / 2];
+  address upper = 0, last = LOW_BITS(img->abits);
+  address pmask = LOW_BITS(img->pbits);
+  int ix, len, count;
+
+  *line = 0;
+
+  while (fgets(buf, sizeof(buf), ifp) != NULL) {
+    unsigned int sum = 0;
+    address offset;
+
+    ++*line;
+    len = strlen(buf);
+
+    /* A record that does not fit in the buffer is not one of ours */
+    if (buf[len - 1] != '\n' && !feof(ifp)) return HEX_SYNTAX;
+
+    while (len > 0 && isspace((int)buf[len - 1])) --len;
+    if (len == 0) continue;
+
+    /* Start character, then an even number of hex digits */
+    if (buf[0] != ':' || len < 11 || len % 2 == 0) return HEX_SYNTAX;
+
+    count = (len - 1) / 2;
+    for (ix = 0; ix < count; ix++) {
+      int hi = hex_value(buf[2 * ix + 1]), lo = hex_value(buf[2 * ix + 2]);
+
+      if (hi < 0 || lo < 0) return HEX_SYNTAX;
+
+      rec[ix] = (hi << 4) | lo;
+      sum += rec[ix];
+    }
+
+    /* Length, address and type, data, checksum */
+    if (rec[0] != count - 5) return HEX_SYNTAX;
+    if ((sum & UCHAR_MAX) != 0) return HEX_CHECKSUM;
+
+    offset = ((address)rec[1] << CHAR_BIT) | rec[2];
+
+    switch (rec[3]) {
+      case DATA_REC:
+        for (ix = 0; ix < rec[0]; ix++) {
+          address addr = upper + offset + ix;
+          byte *page;
+
+          if (addr > last) return HEX_RANGE;
+          if ((page = image_page(img, addr >> img->pbits)) == NULL)
+            return HEX_MEMORY;
+
+          page[(addr & pmask) * img->width] = rec[4 + ix];
+        }
+        break;
+
+      case END_REC:
+        return HEX_OK;
+
+      case OFFSET_REC:
+      case LINEAR_REC:
+        if (rec[0] != 2) return HEX_SYNTAX;
+
+        upper = ((address)rec[4] << CHAR_BIT) | rec[5];
+        upper <<= (rec[3] == OFFSET_REC) ? 4 : 16;
+        break;
+
+      default:
+        break; /* start address records do not concern us */
+    }
+  }
+
+  return HEX_NOEND;
+
+} /* end read_intel() */
+
+/* Whole pages are compared with memcmp(), which the C library does a
+   word or a vector at a time; only a page that differs somewhere is
+   examined byte by byte.
+ */
+int image_diff(image *a, int la, image *b, int lb, address *from,
+               address *to) {
+  byte abuf[1 << PAGE_BITS], bbuf[1 << PAGE_BITS];
+  address pnum, last = LOW_BITS(a->abits);
+  int ix, found = 0, psize = 1 << a->pbits;
+
+  for (pnum = *from >> a->pbits; pnum < a->npages; pnum++) {
+    byte *ap = image_plane(a, la, pnum, abuf);
+    byte *bp = image_plane(b, lb, pnum, bbuf);
+    address base = pnum << a->pbits;
+
+    ix = (base < *from) ? (int)(*from - base) : 0;
+
+    if (!found && ix == 0 && memcmp(ap, bp, psize) == 0) continue;
+
+    for (; ix < psize; ix++) {
+      if (!found && ap[ix] != bp[ix]) {
+        *from = base + ix;
+        found = 1;
+      } else if (found && ap[ix] == bp[ix]) {
+        *to = base + ix - 1;
+        return 1;
+      }
+    }
+  }
+
+  if (found) *to = last;
+
+  return found;
+
+} /* end image_diff() */
 
 /*------------------------------------------------------------------------*/
 
-/* These functions do the work for dump_intel() above, for the various
-   types of records it needs to put into the output stream
+/* These functions do the work for encode_intel() above, for the
+   various types of records it needs to put into the output stream.
+
+   Unless REFERENCE is defined, bytes are converted to hexadecimal by
+   table lookup directly into the output buffer, and the checksum of a
+   data record is accumulated in the same pass.  The reference versions
+   format each field with sprintf(), and must produce identical output.
  */
-void write_data_record(byte *data, int len, address addr, FILE *ofp) {
+static void flush_outbuf(outbuf *ob) {
+  if (ob->len > 0 && ob->ok && !ob->put(ob->arg, ob->buf, ob->len))
+    ob->ok = 0;
+
+  ob->len = 0;
+
+} /* end flush_outbuf() */
+
+#ifdef REFERENCE
+
+void write_data_record(byte *data, int len, address addr, outbuf *ob) {
   byte chk;
   int ix;
 
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+
   /* Output start character and data length */
-  fprintf(ofp, ":%02X", len);
+  ob->len += sprintf(ob->buf + ob->len, ":%02X", len);
 
   /* Output address field and record type */
-  fprintf(ofp, "%04X%02X", addr, DATA_REC);
+  ob->len += sprintf(ob->buf + ob->len, "%04lX%02X", addr, DATA_REC);
 
   /* Output data field ... */
-  for (ix = 0; ix < len; ix++) fprintf(ofp, "%02X", data[ix]);
+  for (ix = 0; ix < len; ix++)
+    ob->len += sprintf(ob->buf + ob->len, "%02X", data[ix]);
 
   /* Compute and output checksum byte, and terminate record */
   chk = compute_data_checksum(len, addr, data);
-  fprintf(ofp, "%02X\n", chk);
+  ob->len += sprintf(ob->buf + ob->len, "%02X\n", chk);
 
 } /* end write_data_record() */
 
-void write_offset_record(address offset, FILE *ofp) {
+void write_offset_record(address offset, outbuf *ob) {
   byte chk;
 
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+
   /* Output start character, data length, address, and record type */
-  fprintf(ofp, ":020000%02X", OFFSET_REC);
+  ob->len += sprintf(ob->buf + ob->len, ":020000%02X", OFFSET_REC);
 
   /* Output offset value ... */
-  fprintf(ofp, "%04X", offset);
+  ob->len += sprintf(ob->buf + ob->len, "%04lX", offset);
 
   /* Compute and output checksum byte, and terminate record */
   chk = compute_offset_checksum(offset);
-  fprintf(ofp, "%02X\n", chk);
+  ob->len += sprintf(ob->buf + ob->len, "%02X\n", chk);
 
 } /* end write_offset_record() */
 
-void write_end_record(FILE *ofp) {
+void write_linear_record(address upper, outbuf *ob) {
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+
+  ob->len += sprintf(ob->buf + ob->len, ":020000%02X%04lX%02X\n", LINEAR_REC,
+                     upper, compute_linear_checksum(upper));
+
+} /* end write_linear_record() */
+
+void write_end_record(outbuf *ob) {
   byte chk;
 
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+
   chk = compute_end_checksum();
-  fprintf(ofp, ":000000%02X%02X\n", END_REC, chk);
+  ob->len += sprintf(ob->buf + ob->len, ":000000%02X%02X\n", END_REC, chk);
 
 } /* end write_end_record() */
 
+#else /* !REFERENCE */
+
+void write_data_record(byte *data, int len, address addr, outbuf *ob) {
+  unsigned int sum = len + ((addr >> CHAR_BIT) & UCHAR_MAX) +
+                     (addr & UCHAR_MAX) + DATA_REC;
+  char *out;
+  int ix;
+
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+  out = ob->buf + ob->len;
+
+  /* Start character, data length, address field and record type */
+  *out++ = ':';
+  out = PUT_HEX(out, len);
+  out = PUT_HEX(out, (addr >> CHAR_BIT) & UCHAR_MAX);
+  out = PUT_HEX(out, addr & UCHAR_MAX);
+  out = PUT_HEX(out, DATA_REC);
+
+  /* Data field, summing as we go */
+  for (ix = 0; ix < len; ix++) {
+    sum += data[ix];
+    out = PUT_HEX(out, data[ix]);
+  }
+
+  /* Checksum byte is the two's complement of the low-order sum byte */
+  sum = (~sum + 1) & UCHAR_MAX;
+  out = PUT_HEX(out, sum);
+  *out++ = '\n';
+
+  ob->len = out - ob->buf;
+
+} /* end write_data_record() */
+
+void write_offset_record(address offset, outbuf *ob) {
+  char *out;
+  byte chk = compute_offset_checksum(offset);
+
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+  out = ob->buf + ob->len;
+
+  memcpy(out, ":020000", 7);
+  out = PUT_HEX(out + 7, OFFSET_REC);
+  out = PUT_HEX(out, (offset >> CHAR_BIT) & UCHAR_MAX);
+  out = PUT_HEX(out, offset & UCHAR_MAX);
+  out = PUT_HEX(out, chk);
+  *out++ = '\n';
+
+  ob->len = out - ob->buf;
+
+} /* end write_offset_record() */
+
+void write_linear_record(address upper, outbuf *ob) {
+  char *out;
+  byte chk = compute_linear_checksum(upper);
+
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+  out = ob->buf + ob->len;
+
+  memcpy(out, ":020000", 7);
+  out = PUT_HEX(out + 7, LINEAR_REC);
+  out = PUT_HEX(out, (upper >> CHAR_BIT) & UCHAR_MAX);
+  out = PUT_HEX(out, upper & UCHAR_MAX);
+  out = PUT_HEX(out, chk);
+  *out++ = '\n';
+
+  ob->len = out - ob->buf;
+
+} /* end write_linear_record() */
+
+void write_end_record(outbuf *ob) {
+  char *out;
+  byte chk = compute_end_checksum();
+
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+  out = ob->buf + ob->len;
+
+  memcpy(out, ":000000", 7);
+  out = PUT_HEX(out + 7, END_REC);
+  out = PUT_HEX(out, chk);
+  *out++ = '\n';
+
+  ob->len = out - ob->buf;
+
+} /* end write_end_record() */
+
+#endif /* REFERENCE */
+
+/* An S-record of type 'type', with an address field 'abytes' long.
+   Its length byte counts the address, data and checksum, and the
+   checksum is the one's complement of the sum of all those bytes.
+ */
+void write_srec_record(int type, int abytes, address addr, byte *data,
+                       int len, outbuf *ob) {
+  unsigned int sum = abytes + len + 1;
+  char *out;
+  int ix;
+
+  if (ob->len + MAX_RECORD > OBUF_SIZE) flush_outbuf(ob);
+  out = ob->buf + ob->len;
+
+  *out++ = 'S';
+  *out++ = '0' + type;
+  out = PUT_HEX(out, abytes + len + 1);
+
+  for (ix = abytes - 1; ix >= 0; ix--) {
+    byte b = (addr >> (ix * CHAR_BIT)) & UCHAR_MAX;
+
+    sum += b;
+    out = PUT_HEX(out, b);
+  }
+
+  for (ix = 0; ix < len; ix++) {
+    sum += data[ix];
+    out = PUT_HEX(out, data[ix]);
+  }
+
+  sum = ~sum & UCHAR_MAX;
+  out = PUT_HEX(out, sum);
+  *out++ = '\n';
+
+  ob->len = out - ob->buf;
+
+} /* end write_srec_record() */
+
+char *put_digits(char *out, address v, int n) {
+  while (n-- > 0) *out++ = s_hexdigit[(v >> (4 * n)) & 0xF];
+
+  return out;
+
+} /* end put_digits() */
+
 /* Here there be dragons */
@@ -11,18 +11,123 @@
 #ifndef _H_ROM_
 #define _H_ROM_
 
+#include <limits.h>
 #include <stdio.h>
 
 typedef unsigned char	byte;
-typedef unsigned int	address;
+typedef unsigned long	address;   /* at least 32 bits */
 
 /* Record type codes */
 #define DATA_REC		0
 #define END_REC			1
 #define OFFSET_REC		2
 #define START_REC		3   /* not used here */
+#define LINEAR_REC		4   /* extended linear address */
 
 #define	CHUNK_SIZE		16  /* data written in chunks this big */
+#define LINE_BYTES		16  /* bytes per line of hex dump formats */
+#define PAGE_BITS		12  /* log2 of ROM image page size     */
+#define DENSE_BITS		20  /* dump_intel() writes every page up to here */
+
+/* Mask for the low-order 'n' bits of an address, 0 <= n <= 32 */
+#define LOW_BITS(n) \
+  ((n) < (int)(sizeof(address) * CHAR_BIT) ? ((address)1 << (n)) - 1 \
+                                            : ~(address)0)
+
+/* A ROM image is kept as a table of fixed-size pages, each of which is
+   allocated the first time something is written to it.  Locations in
+   pages that have never been written read as 'fill'.  Thus the memory
+   used grows with the data actually written, rather than with the
+   size of the address space.
+
+   Each location holds 'width' bytes.  An image with a width greater
+   than 1 interleaves several ROMs, one per byte "lane", so that all of
+   them can be written in a single pass over the addresses.
+ */
+typedef struct {
+  int abits;      /* number of address bits         */
+  int width;      /* bytes per location             */
+  int pbits;      /* log2 of locations per page     */
+  byte fill;      /* value of unwritten locations   */
+  address npages; /* number of pages in the table   */
+  byte **page;    /* page table; NULL if unwritten  */
+  byte *blank;    /* a page full of the fill value  */
+  byte *map;      /* mapped file holding the pages  */
+} image;
+
+/* Create an empty image for an 'abits'-bit address space, 'width'
+   bytes wide, with every byte holding 'fill'.  Returns NULL if memory
+   could not be had.
+ */
+image *new_image(int abits, int width, byte fill);
+
+#ifdef USE_MMAP
+/* Create an image, as new_image() does, whose locations are held in
+   the file 'path', 'width' bytes each, one after another.  The file
+   is created (or emptied) and sized to hold them, and shared with the
+   image, so that writing to the image writes the file, with no copy
+   in memory.  Pages of the file are filled in the first time they are
+   written.  Returns NULL if the file could not be made or mapped.
+ */
+image *map_image(char *path, int abits, int width, byte fill);
+#endif
+
+/* For an image made by map_image(), store the fill value in the pages
+   that were never written, so that the file holds every location, and
+   start writing its pages out.  Does nothing to other images.
+   Returns false if the file could not be written.
+ */
+int sync_image(image *img);
+
+/* Release all the memory used by an image (unmapping its file, if it
+   has one)
+ */
+void free_image(image *img);
+
+/* Bytes of memory used by an image for its pages */
+double image_size(image *img);
+
+/* Return a pointer to page number 'pnum' of the image for writing,
+   allocating it if necessary, or NULL if memory could not be had.
+ */
+byte *image_page(image *img, address pnum);
+
+/* Release 'count' pages of an image, from page number 'first' on, so
+   that they read as the fill value again.  The pages of a mapped image
+   are kept.
+ */
+void release_pages(image *img, address first, address count);
+
+/* Page number 'P' of image 'I', for reading only */
+#define PAGE_DATA(I, P) ((I)->page[P] ? (I)->page[P] : (I)->blank)
+
+/* Return the value stored in lane 'lane' of a given location */
+byte image_read(image *img, address addr, int lane);
+
+/* Return a pointer to the bytes of lane 'lane' for each location of
+   page 'pnum', in address order, for reading only.  If the image is
+   more than one byte wide, these are gathered into 'buf', which must
+   have room for a page of locations.
+ */
+byte *image_plane(image *img, int lane, address pnum, byte *buf);
+
+/* As image_plane(), but gather 'count' lanes of each location, from
+   lane 'lane' on, into 'buf', which must have room for 'count' bytes
+   per location of the page.  They are kept in lane order, or put in
+   the reverse order if 'rev' is true.  If they are the whole of each
+   location, in order, the page itself is returned.
+ */
+byte *image_lanes(image *img, int lane, int count, int rev, address pnum,
+                  byte *buf);
+
+/* Make an image one byte wide holding the words of 'count' lanes of
+   'img', from lane 'lane' on, as the encoders write them: location
+   'a' of 'img' becomes locations a * count ... a * count + count - 1,
+   in lane order, or the reverse if 'rev' is true.  'count' must be a
+   power of two.  Only the pages that were written are copied.
+   Returns NULL if memory could not be had.
+ */
+image *unpack_words(image *img, int lane, int count, int rev);
 
 /* Compute two's complement checksum byte for an output record
      count   - number of bytes in data field
@@ -35,31 +140,189 @@ typedef unsigned int	address;
  */
 byte compute_data_checksum(byte count, address addr, byte *data);
 byte compute_offset_checksum(address offset);
+byte compute_linear_checksum(address upper);
 byte compute_end_checksum(void);
 
 /* Using 'addr' as a base address, possibly including "don't care"
    designators, write byte value 'val' to all the memory addresses
-   indicated by the address itself.  The ROM image is presumed to have
-   enough storage available for this to work.
+   indicated by the address itself.  Returns true if successful, false
+   if memory for the image could not be had.
 
    The 'addr' parameter is a string of '0', '1', and 'x' characters
    denoting the address to be considered.  An 'x' denotes a don't care
    value.  The 'alen' parameter is the length of the address, which is
    not presumed to be zero-terminated.
  */
-void write_range(byte *rom, char *addr, int alen, byte val);
+int write_range(image *img, char *addr, int alen, byte val);
+
+/* Compile an address string (as for write_range()) into a base
+   address having all don't-care bits set to zero, and a mask having
+   a one in each don't-care position.  Together these describe the
+   "cube" of addresses the string denotes.
+ */
+void compile_range(char *addr, int alen, address *base, address *mask);
+
+/* Write byte value 'val' to every address in the cube described by
+   'base' and 'mask', as computed by compile_range(), in an image one
+   byte wide.  The cost is constant per address written, independent
+   of the address length.  Returns true if successful, false if memory
+   could not be had.
+ */
+int write_cube(image *img, address base, address mask, byte val);
+
+/* As write_cube(), but writes all the lanes of each location at once,
+   from the 'width' bytes at 'vals'
+ */
+int write_words(image *img, address base, address mask, byte *vals);
 
-/* Dump a ROM image out in various formats:
+/* Compute the intersection of the cubes (b1, m1) and (b2, m2), storing
+   it in 'base' and 'mask'.  Returns true if the cubes intersect; false
+   if they have no address in common (in which case the outputs are
+   not changed).
+ */
+int cube_intersect(address b1, address m1, address b2, address m2,
+                   address *base, address *mask);
+
+/* Dump lane 'lane' of a ROM image out in various formats:
 
      dump_raw()	  - raw bytes of the ROM, in binary
      dump_text()  - literal bytes of the ROM, human-readable
      dump_intel() - Intel ROM programmer format, with addresses
 
    The dump_intel() function accounts for ROM sizes larger than 64K by
-   writing extended address records (OFFSET_REC) whenever appropriate
+   writing extended address records (OFFSET_REC) whenever appropriate.
+   Images of more than DENSE_BITS address bits are too big for those,
+   so extended linear address records (LINEAR_REC) are used instead,
+   and only pages that have been written are included in the output.
+ */
+void dump_raw(image *img, int lane, FILE *ofp);
+void dump_text(image *img, int lane, FILE *ofp);
+void dump_intel(image *img, int lane, FILE *ofp);
+
+/* The encoders behind the dump functions hand their output to a
+   function like this, a block at a time, along with the 'arg' they
+   were given.  It returns false if it could not take the block, which
+   stops the encoder.
+ */
+typedef int (*sink_func)(void *arg, char *buf, size_t len);
+
+/* Encode lane 'lane' of a ROM image as the dump functions above do,
+   passing the output to 'put'.  Returns false if 'put' failed.
+ */
+int encode_raw(image *img, int lane, sink_func put, void *arg);
+int encode_text(image *img, int lane, sink_func put, void *arg);
+int encode_intel(image *img, int lane, sink_func put, void *arg);
+
+/* How the encoders lay out the records of formats that give the
+   address of their data.  Intel HEX records and S-records carry up to
+   'reclen' bytes of data each (at most MAX_RECLEN, and less for long
+   S-record addresses).  If 'blank' is a byte value rather than
+   NO_BLANK, runs of at least MIN_GAP locations holding it are left
+   out of those formats and of TI-TXT and $readmemh files, as though
+   they had never been written.
+
+   Each location of the output is a word of 'wbytes' lanes of the
+   image (a power of two), written as that many bytes at consecutive
+   addresses, least significant (lowest lane) first, or most
+   significant first if 'big' is true.  A $readmemh file instead has a
+   line entry for each word, with word addresses, as Verilog reads it.
+ */
+typedef struct {
+  int reclen; /* data bytes per record             */
+  int blank;  /* value of locations left out       */
+  int wbytes; /* bytes of each word                */
+  int big;    /* most significant byte first?      */
+} encoding;
+
+#define MAX_RECLEN 255 /* longest Intel HEX data record  */
+#define NO_BLANK -1    /* leave no locations out         */
+#define MIN_GAP 8      /* shortest run of blanks skipped */
+
+/* Fill in the default encoding: CHUNK_SIZE records, nothing left
+   out, and words of a single byte
+ */
+void default_encoding(encoding *en);
+
+/* Output formats for start_encoding() and encode_image() */
+#define RAW_ENC 1    /* as encode_raw()                    */
+#define TEXT_ENC 2   /* as encode_text()                   */
+#define INTEL_ENC 3  /* as encode_intel()                  */
+#define SREC_ENC 4   /* Motorola S-records                 */
+#define TITXT_ENC 5  /* TI-TXT (MSP430 programmers)        */
+#define VMEM_ENC 6   /* Verilog $readmemh                  */
+#define CARRAY_ENC 7 /* C array initialiser                */
+#define NUM_ENC 7
+
+/* Encode lane 'lane' of a ROM image in format 'fmt' (one of the
+   xxx_ENC codes above), laid out as 'en' says (or by default, if it
+   is NULL), passing the output to 'put'.  For words of more than one
+   byte, the lanes from 'lane' on are taken together; there must be
+   that many, and the byte addresses of the output must fit in 32
+   bits.  Returns false if 'put' failed, or memory could not be had.
+
+   S-records use S1, S2 or S3 data records (the S19, S28 or S37 forms)
+   according to the number of address bits, and end with a count
+   record if the count fits.  TI-TXT and $readmemh files give the
+   address of each run of data with an '@' line, sixteen bytes to a
+   line.  As for Intel HEX, unwritten pages of images of more than
+   DENSE_BITS address bits are left out of these three formats.  A C
+   array is a definition of 'const unsigned char ROM_NAME[]', where
+   ROM_NAME is 'rom_image' unless it is already defined as a macro.
+ */
+int encode_image(image *img, int lane, int fmt, encoding *en, sink_func put,
+                 void *arg);
+
+/* As encode_image(), writing to a file */
+void dump_image(image *img, int lane, int fmt, encoding *en, FILE *ofp);
+
+/* An image being encoded a range of pages at a time, so that the pages
+   may be filled in just before they are encoded and released after
+ */
+typedef struct encoder encoder;
+
+/* Start encoding lane 'lane' of an image in format 'fmt' (one of the
+   xxx_ENC codes above), laid out as for encode_image(), passing the
+   output to 'put'.  Returns NULL if memory could not be had.
+ */
+encoder *start_encoding(image *img, int lane, int fmt, encoding *en,
+                        sink_func put, void *arg);
+
+/* Encode 'count' pages of the image, from page number 'first' on.
+   Each call must take up where the last one left off.  Returns false
+   if 'put' has failed.
+ */
+int encode_pages(encoder *ep, address first, address count);
+
+/* Finish the output once every page has been encoded, and release the
+   encoder.  Returns false if 'put' has failed.
+ */
+int finish_encoding(encoder *ep);
+
+/* Results from read_intel() */
+#define HEX_OK 0       /* file was read successfully     */
+#define HEX_SYNTAX 1   /* malformed record               */
+#define HEX_CHECKSUM 2 /* record checksum is wrong       */
+#define HEX_RANGE 3    /* data lies outside the image    */
+#define HEX_NOEND 4    /* file has no end record         */
+#define HEX_MEMORY 5   /* memory could not be had        */
+
+/* Read an Intel HEX file into an image one byte wide.  Extended
+   segment (OFFSET_REC) and extended linear (LINEAR_REC) address
+   records are understood, and every record's checksum is checked.
+   Locations the file does not mention are left as they were.  The
+   number of the last line read is stored in 'line'.
+
+   Returns one of the HEX_xxx codes above.
+ */
+int read_intel(image *img, FILE *ifp, int *line);
+
+/* Find the first run of locations at or after '*from' in which lane
+   'la' of image 'a' differs from lane 'lb' of image 'b'.  The images
+   must have the same number of address bits.  If there is such a run,
+   its first and last addresses are stored in 'from' and 'to', and
+   true is returned; otherwise false.
  */
-void dump_raw(byte *rom, int rlen, FILE *ofp);
-void dump_text(byte *rom, int rlen, FILE *ofp);
-void dump_intel(byte *rom, int rlen, FILE *ofp);
+int image_diff(image *a, int la, image *b, int lb, address *from,
+               address *to);
 
 #endif /* end _H_ROM_ */
@@ -0,0 +1,718 @@
+/*
+  sim.c
+
+  Running the state machine a truth table describes, from the ROM
+  images compiled for it, for tt2rom version 2.
+ */
+
+#include "sim.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#define CHUNK_WORDS 4096 /* words read from a ROM at a time */
+#define PAR_WORK 65536   /* look-ups worth sharing among threads */
+
+/* Is 'ch' a character of a ROM name? */
+#define NAME_CHAR(ch) (isalnum((int)(ch)) || (ch) == '_')
+
+/* Parse the feedback pairs of 'spec', making a table for each byte of
+   a ROM's word that feeds any state bits: for each value of the byte,
+   the state bits it gives, in their places in the address.  Returns
+   one of the SIM_xxx codes.
+ */
+static int parse_feedback(tt_table *tp, char *spec, machine *mp,
+                          address *tab[TT_MAXROMS][TT_MAXWORD]);
+
+/* Take one run, adding the addresses it visits to 'seen' */
+static void take_run(machine *mp, simrun *rp, bitword *seen);
+
+void free_machine(machine *mp) {
+  free(mp->next);
+  mp->next = NULL;
+
+} /* end free_machine() */
+
+static int parse_feedback(tt_table *tp, char *spec, machine *mp,
+                          address *tab[TT_MAXROMS][TT_MAXWORD]) {
+  char *end, *name;
+  long abit, bit;
+  int num = 0, val;
+
+  while (*spec != '\0') {
+    if (!isdigit((int)*spec)) return SIM_BADSPEC;
+    abit = strtol(spec, &spec, 10);
+    if (*spec++ != '=' || abit >= mp->abits ||
+        (mp->state & ((address)1 << abit)) != 0)
+      return SIM_BADSPEC;
+
+    /* The ROM, by number or name */
+    for (end = spec; NAME_CHAR(*end);) ++end;
+    if (end == spec || *end != ':') return SIM_BADSPEC;
+
+    if (isdigit((int)*spec)) {
+      long n = strtol(spec, &spec, 10);
+
+      if (spec != end || n >= tp->nroms) return SIM_BADSPEC;
+      num = (int)n;
+    } else {
+      for (num = 0; num < tp->nroms; num++)
+        if ((name = tt_rom_name(tp, num)) != NULL &&
+            (int)strlen(name) == end - spec &&
+            strncmp(name, spec, end - spec) == 0)
+          break;
+    }
+
+    spec = end + 1;
+    if (!isdigit((int)*spec)) return SIM_BADSPEC;
+    bit = strtol(spec, &spec, 10);
+    if (bit >= tt_word_bytes(tp, num) * CHAR_BIT) return SIM_BADSPEC;
+
+    if (*spec == ',')
+      ++spec;
+    else if (*spec != '\0')
+      return SIM_BADSPEC;
+
+    /* Every value of the byte with the bit set feeds the state bit */
+    if (tab[num][bit / CHAR_BIT] == NULL &&
+        (tab[num][bit / CHAR_BIT] = calloc(UCHAR_MAX + 1, sizeof(address))) ==
+            NULL)
+      return SIM_MEMORY;
+
+    for (val = 0; val <= UCHAR_MAX; val++)
+      if ((val >> (bit % CHAR_BIT)) & 1)
+        tab[num][bit / CHAR_BIT][val] |= (address)1 << abit;
+
+    mp->state |= (address)1 << abit;
+  }
+
+  return SIM_OK;
+
+} /* end parse_feedback() */
+
+/*
+  The words of each ROM that feeds back are read a chunk at a time,
+  and each byte that holds state bits is looked up in its table, so
+  that the state bits at an address take one look-up per byte, however
+  many bits there are.
+ */
+int make_machine(tt_table *tp, char *spec, machine *mp) {
+  address *tab[TT_MAXROMS][TT_MAXWORD];
+  address start, last, len, ix;
+  byte *buf = NULL;
+  int num, k, wbytes, res;
+
+  mp->abits = tp->abits;
+  mp->state = 0;
+  mp->next = NULL;
+
+  memset(tab, 0, sizeof(tab));
+
+  if ((res = parse_feedback(tp, spec, mp, tab)) == SIM_OK) {
+    mp->input = LOW_BITS(mp->abits) & ~mp->state;
+    for (mp->nin = 0, ix = mp->input; ix != 0; ix &= ix - 1) ++mp->nin;
+
+    if (mp->abits >= (int)(sizeof(size_t) * CHAR_BIT) - 4 ||
+        (mp->next = calloc((size_t)1 << mp->abits, sizeof(address))) ==
+            NULL ||
+        (buf = malloc(CHUNK_WORDS * TT_MAXWORD)) == NULL)
+      res = SIM_MEMORY;
+  }
+
+  last = LOW_BITS(mp->abits);
+
+  for (num = 0; num < tp->nroms && res == SIM_OK; num++) {
+    wbytes = tt_word_bytes(tp, num);
+
+    for (k = 0; k < wbytes && tab[num][k] == NULL;) ++k;
+    if (k == wbytes) continue;
+
+    for (start = 0; res == SIM_OK; start += len) {
+      len = (last - start < CHUNK_WORDS) ? last - start + 1 : CHUNK_WORDS;
+
+      if (!tt_read_rom(tp, num, start, len, buf)) {
+        res = SIM_MEMORY;
+        break;
+      }
+
+      /* Byte 'k' of a word is stored in the table's byte order */
+      for (k = 0; k < wbytes; k++) {
+        address *tk = tab[num][k];
+        byte *bp = buf + (tp->opt.enc.big ? wbytes - 1 - k : k);
+
+        if (tk == NULL) continue;
+
+        for (ix = 0; ix < len; ix++, bp += wbytes)
+          mp->next[start + ix] |= tk[*bp];
+      }
+
+      if (last - start < CHUNK_WORDS) break;
+    }
+  }
+
+  for (num = 0; num < TT_MAXROMS; num++)
+    for (k = 0; k < TT_MAXWORD; k++) free(tab[num][k]);
+  free(buf);
+
+  return res;
+
+} /* end make_machine() */
+
+int parse_vector(machine *mp, char *line, vector *vp) {
+  address bit;
+  char *endp;
+
+  vp->in = 0;
+  vp->count = 1;
+
+  /* The input bits, from the most significant down */
+  for (bit = (address)1 << (mp->abits - 1); bit != 0; bit >>= 1) {
+    if ((mp->input & bit) == 0) continue;
+
+    if (*line == '1')
+      vp->in |= bit;
+    else if (*line != '0')
+      return 0;
+    ++line;
+  }
+
+  if (*line == '*') {
+    if (!isdigit((int)line[1])) return 0;
+
+    vp->count = strtoul(line + 1, &endp, 10);
+    if (vp->count == 0) return 0;
+    line = endp;
+  }
+
+  return (*line == '\0');
+
+} /* end parse_vector() */
+
+/*
+  The loop is kept as small as it can be: the address is the state
+  bits with the inputs, and the next state bits are found at once, so
+  each step is an OR and a load.  Marking the addresses visited costs
+  a little more, so it is done in a loop of its own.
+ */
+static void take_run(machine *mp, simrun *rp, bitword *seen) {
+  address *next = mp->next, state = rp->start & mp->state, in, addr;
+  unsigned long n;
+  int ix;
+
+  rp->steps = 0;
+
+  for (ix = 0; ix < rp->nvec; ix++) {
+    in = rp->vec[ix].in;
+    n = rp->vec[ix].count;
+
+    if (seen) {
+      while (n-- > 0) {
+        addr = state | in;
+        ADD_SET(seen, addr);
+        state = next[addr];
+      }
+    } else {
+      while (n-- > 0) state = next[state | in];
+    }
+
+    rp->steps += rp->vec[ix].count;
+  }
+
+  rp->end = state;
+
+} /* end take_run() */
+
+#ifdef USE_THREADS
+
+/* The runs shared by the threads of run_machine() */
+typedef struct {
+  machine *mp;
+  simrun *runs;
+  int nruns;
+  int next;      /* next run to be taken    */
+  bitword *seen; /* addresses of all runs   */
+  int ok;        /* false if memory ran out */
+  pthread_mutex_t lock;
+} runwork;
+
+/*
+  Each thread takes the next run that is left until there are none,
+  marking the addresses it visits in a set of its own, which is
+  added to the shared one at the end; so the threads need no locking
+  as they step.
+ */
+static void *run_worker(void *arg) {
+  runwork *rw = arg;
+  bitword *seen = NULL;
+  size_t ix, nw = SET_WORDS(rw->mp->abits);
+
+  if (rw->seen != NULL && (seen = calloc(nw, sizeof(bitword))) == NULL) {
+    pthread_mutex_lock(&rw->lock);
+    rw->ok = 0;
+    rw->next = rw->nruns;
+    pthread_mutex_unlock(&rw->lock);
+    return NULL;
+  }
+
+  while (1) {
+    int run;
+
+    pthread_mutex_lock(&rw->lock);
+    run = rw->next++;
+    pthread_mutex_unlock(&rw->lock);
+
+    if (run >= rw->nruns) break;
+
+    take_run(rw->mp, rw->runs + run, seen);
+  }
+
+  if (seen != NULL) {
+    pthread_mutex_lock(&rw->lock);
+    for (ix = 0; ix < nw; ix++) rw->seen[ix] |= seen[ix];
+    pthread_mutex_unlock(&rw->lock);
+
+    free(seen);
+  }
+
+  return NULL;
+
+} /* end run_worker() */
+
+#endif /* USE_THREADS */
+
+int run_machine(machine *mp, simrun *runs, int nruns, int nthreads,
+                bitword *seen) {
+  int ix;
+#ifdef USE_THREADS
+  runwork rw;
+  pthread_t *tids;
+  int nstarted = 0;
+
+  if (nthreads > nruns) nthreads = nruns;
+
+  if (nthreads > 1 && (tids = calloc(nthreads, sizeof(pthread_t))) != NULL) {
+    rw.mp = mp;
+    rw.runs = runs;
+    rw.nruns = nruns;
+    rw.next = 0;
+    rw.seen = seen;
+    rw.ok = 1;
+    pthread_mutex_init(&rw.lock, NULL);
+
+    for (ix = 1; ix < nthreads; ix++) {
+      if (pthread_create(tids + nstarted, NULL, run_worker, &rw) != 0) break;
+      ++nstarted;
+    }
+
+    /* This thread takes runs too, and any the others do not get to
+       (if some of them could not be started)
+     */
+    run_worker(&rw);
+
+    for (ix = 0; ix < nstarted; ix++) pthread_join(tids[ix], NULL);
+
+    pthread_mutex_destroy(&rw.lock);
+    free(tids);
+    return rw.ok;
+  }
+#endif /* USE_THREADS */
+
+  for (ix = 0; ix < nruns; ix++) take_run(mp, runs + ix, seen);
+
+  return 1;
+
+} /* end run_machine() */
+
+long trace_run(machine *mp, simrun *rp, address *addrs, long max) {
+  address state = rp->start & mp->state, in;
+  unsigned long n;
+  long steps = 0;
+  int ix;
+
+  for (ix = 0; ix < rp->nvec && steps < max; ix++) {
+    in = rp->vec[ix].in;
+
+    for (n = rp->vec[ix].count; n > 0 && steps < max; n--) {
+      addrs[steps++] = state | in;
+      state = mp->next[state | in];
+    }
+  }
+
+  return steps;
+
+} /* end trace_run() */
+
+/* Count the bits of a word, a few at a time in parallel: pairs of
+   bits, then nybbles, then bytes, which are summed by a multiply
+ */
+static int count_word(bitword w) {
+  w = w - ((w >> 1) & (~(bitword)0 / 3));
+  w = (w & (~(bitword)0 / 5)) + ((w >> 2) & (~(bitword)0 / 5));
+  w = (w + (w >> 4)) & (~(bitword)0 / 17);
+
+  return (int)((w * (~(bitword)0 / 255)) >> (WORD_BITS - CHAR_BIT));
+
+} /* end count_word() */
+
+double count_set(bitword *set, size_t nwords) {
+  double count = 0;
+  size_t ix;
+
+  for (ix = 0; ix < nwords; ix++)
+    if (set[ix] != 0) count += count_word(set[ix]);
+
+  return count;
+
+} /* end count_set() */
+
+/* A part of a level of the search: the words 'lo' up to 'hi' of the
+   frontier, and the states found from them that were not reached
+   before, in a set of the part's own.  The words of that set in which
+   any were found are 'flo' to 'fhi'; if none were, 'flo' > 'fhi'.
+ */
+typedef struct {
+  machine *mp;
+  bitword *front;
+  bitword *reached;
+  size_t lo, hi;
+  bitword *found;
+  size_t flo, fhi;
+} reachpart;
+
+/* Look up the next state of every state in a part of the frontier,
+   for every value of the inputs
+ */
+static void expand_part(reachpart *pp) {
+  address next, state, in, input = pp->mp->input;
+  size_t ix, w;
+  bitword bits;
+  int b;
+
+  for (ix = pp->lo; ix < pp->hi; ix++) {
+    for (bits = pp->front[ix], b = 0; bits != 0; bits >>= 1, b++) {
+      if ((bits & 1) == 0) continue;
+
+      state = (address)ix * WORD_BITS + b;
+      in = 0;
+      do {
+        next = pp->mp->next[state | in];
+
+        if (!IN_SET(pp->reached, next) && !IN_SET(pp->found, next)) {
+          ADD_SET(pp->found, next);
+
+          w = next / WORD_BITS;
+          if (w < pp->flo) pp->flo = w;
+          if (w > pp->fhi) pp->fhi = w;
+        }
+
+        /* The next value of the input bits, counting in their places */
+        in = (in - input) & input;
+      } while (in != 0);
+    }
+  }
+
+} /* end expand_part() */
+
+#ifdef USE_THREADS
+static void *expand_worker(void *arg) {
+  expand_part(arg);
+  return NULL;
+
+} /* end expand_worker() */
+#endif /* USE_THREADS */
+
+/*
+  The frontier (the states first reached at the last level) is kept as
+  a set, along with the range of its words that may hold any.  Each
+  part of it is expanded into a set of its own, and the parts are then
+  merged, so that the threads never write to the same memory; only the
+  words each part touched are merged and cleared, so a level with few
+  states costs little however large the machine is.  A level is only
+  shared among threads if it takes enough look-ups to pay for them.
+ */
+long reach_states(machine *mp, address start, int nthreads,
+                  bitword *reached) {
+  size_t nw = SET_WORDS(mp->abits), lo, hi, ix;
+  bitword *front, *found, bits;
+  reachpart *parts;
+  double ways = 1;
+  long levels = 0;
+  int k, nparts;
+#ifdef USE_THREADS
+  pthread_t *tids;
+  int *started;
+#endif
+
+  if (nthreads < 1) nthreads = 1;
+
+  front = calloc(nw, sizeof(bitword));
+  found = calloc(nthreads * nw, sizeof(bitword));
+  parts = calloc(nthreads, sizeof(reachpart));
+#ifdef USE_THREADS
+  tids = calloc(nthreads, sizeof(pthread_t));
+  started = calloc(nthreads, sizeof(int));
+  if (tids == NULL || started == NULL) levels = -1;
+#endif
+  if (front == NULL || found == NULL || parts == NULL) levels = -1;
+
+  for (ix = 0; ix < (size_t)mp->nin; ix++) ways *= 2;
+
+  /* If memory could not be had, there is no frontier to search */
+  lo = hi = 0;
+  if (levels == 0) {
+    start &= mp->state;
+    ADD_SET(reached, start);
+    ADD_SET(front, start);
+    lo = start / WORD_BITS;
+    hi = lo + 1;
+  }
+
+  while (lo < hi) {
+    nparts = 1;
+#ifdef USE_THREADS
+    if (nthreads > 1 && count_set(front + lo, hi - lo) * ways >= PAR_WORK)
+      nparts = (hi - lo < (size_t)nthreads) ? (int)(hi - lo) : nthreads;
+#endif
+
+    for (k = 0; k < nparts; k++) {
+      parts[k].mp = mp;
+      parts[k].front = front;
+      parts[k].reached = reached;
+      parts[k].lo = lo + (hi - lo) * k / nparts;
+      parts[k].hi = lo + (hi - lo) * (k + 1) / nparts;
+      parts[k].found = found + k * nw;
+      parts[k].flo = nw;
+      parts[k].fhi = 0;
+    }
+
+#ifdef USE_THREADS
+    /* A part whose thread could not be started is expanded here */
+    for (k = 1; k < nparts; k++)
+      started[k] =
+          (pthread_create(tids + k, NULL, expand_worker, parts + k) == 0);
+
+    expand_part(parts);
+
+    for (k = 1; k < nparts; k++) {
+      if (started[k])
+        pthread_join(tids[k], NULL);
+      else
+        expand_part(parts + k);
+    }
+#else
+    expand_part(parts);
+#endif
+
+    for (ix = lo; ix < hi; ix++) front[ix] = 0;
+
+    /* The states found by several parts are taken from the first */
+    lo = nw;
+    hi = 0;
+    for (k = 0; k < nparts; k++) {
+      for (ix = parts[k].flo; ix <= parts[k].fhi; ix++) {
+        bits = parts[k].found[ix] & ~reached[ix];
+        parts[k].found[ix] = 0;
+        if (bits == 0) continue;
+
+        reached[ix] |= bits;
+        front[ix] |= bits;
+        if (ix < lo) lo = ix;
+        if (ix >= hi) hi = ix + 1;
+      }
+    }
+
+    if (lo < hi) ++levels;
+  }
+
+  free(front);
+  free(found);
+  free(parts);
+#ifdef USE_THREADS
+  free(tids);
+  free(started);
+#endif
+
+  return levels;
+
+} /* end reach_states() */
+
+/* Divide a set of the addresses of 'k' bits that fits in one word, as
+   find_cubes() does; 'base' and 'mask' give the cube the set is of
+ */
+static void word_cubes(bitword w, int k, address base, address mask,
+                       cube_func report, void *arg) {
+  address top;
+  bitword low, both;
+  int half;
+
+  if (w == 0) return;
+
+  if (count_word(w) == 1 << k) {
+    report(arg, base, mask | LOW_BITS(k));
+    return;
+  }
+
+  half = 1 << (k - 1);
+  top = (address)1 << (k - 1);
+  low = w & (((bitword)1 << half) - 1);
+  w >>= half;
+  both = low & w;
+
+  word_cubes(both, k - 1, base, mask | top, report, arg);
+  word_cubes(low & ~both, k - 1, base, mask, report, arg);
+  word_cubes(w & ~both, k - 1, base | top, mask, report, arg);
+
+} /* end word_cubes() */
+
+/* Divide a set of the addresses of 'k' bits, which has 2^k / WORD_BITS
+   words, each half of the set being found at once as words
+ */
+static int set_cubes(bitword *set, int k, int wlog, address base,
+                     address mask, cube_func report, void *arg) {
+  size_t ix, nw, half;
+  bitword *both, *low, *high;
+  address top;
+  double count;
+  int ok;
+
+  if (k <= wlog) {
+    word_cubes(set[0], k, base, mask, report, arg);
+    return 1;
+  }
+
+  nw = (size_t)1 << (k - wlog);
+  if ((count = count_set(set, nw)) == 0) return 1;
+
+  if (count == (double)nw * WORD_BITS) {
+    report(arg, base, mask | LOW_BITS(k));
+    return 1;
+  }
+
+  half = nw / 2;
+  if ((both = malloc(3 * half * sizeof(bitword))) == NULL) return 0;
+  low = both + half;
+  high = low + half;
+
+  for (ix = 0; ix < half; ix++) {
+    both[ix] = set[ix] & set[half + ix];
+    low[ix] = set[ix] & ~both[ix];
+    high[ix] = set[half + ix] & ~both[ix];
+  }
+
+  top = (address)1 << (k - 1);
+  ok = set_cubes(both, k - 1, wlog, base, mask | top, report, arg) &&
+       set_cubes(low, k - 1, wlog, base, mask, report, arg) &&
+       set_cubes(high, k - 1, wlog, base | top, mask, report, arg);
+
+  free(both);
+
+  return ok;
+
+} /* end set_cubes() */
+
+int find_cubes(bitword *set, int abits, cube_func report, void *arg) {
+  int wlog = 0;
+
+  while ((1 << wlog) < WORD_BITS) ++wlog;
+
+  return set_cubes(set, abits, wlog, 0, 0, report, arg);
+
+} /* end find_cubes() */
+
+/* Spread the low bits of 'x' out to the places of the bits of 'bits' */
+static address deposit(address x, address bits) {
+  address res = 0;
+
+  for (; bits != 0; bits &= bits - 1, x >>= 1)
+    if (x & 1) res |= bits & ~(bits - 1);
+
+  return res;
+
+} /* end deposit() */
+
+/* The cubes of the states of a machine, numbered in order */
+typedef struct {
+  machine *mp;
+  cube_func report;
+  void *arg;
+} statecubes;
+
+static void state_cube(void *arg, address base, address mask) {
+  statecubes *sc = arg;
+
+  sc->report(sc->arg, deposit(base, sc->mp->state),
+             deposit(mask, sc->mp->state) | sc->mp->input);
+
+} /* end state_cube() */
+
+/*
+  The states are numbered in order, so that the set of those not
+  reached has no gaps for the input bits, and it is that set that is
+  divided into cubes.
+ */
+int unreached_states(machine *mp, bitword *reached, cube_func report,
+                     void *arg) {
+  int nstate = mp->abits - mp->nin, ok;
+  address state = 0, num = 0;
+  statecubes sc;
+  bitword *set;
+
+  if ((set = calloc(SET_WORDS(nstate), sizeof(bitword))) == NULL) return 0;
+
+  /* Counting in the places of the state bits visits them in order */
+  do {
+    if (!IN_SET(reached, state)) ADD_SET(set, num);
+    ++num;
+    state = (state - mp->state) & mp->state;
+  } while (state != 0);
+
+  sc.mp = mp;
+  sc.report = report;
+  sc.arg = arg;
+  ok = find_cubes(set, nstate, state_cube, &sc);
+
+  free(set);
+
+  return ok;
+
+} /* end unreached_states() */
+
+/* The rows are written into a scratch image, as for tt_coverage(), so
+   that the addresses left unwritten are those no row covers
+ */
+int find_holes(tt_table *tp, bitword *holes) {
+  address pnum, addr;
+  int ix, psize;
+  image *cov;
+
+  if ((cov = new_image(tp->abits, 1, 0)) == NULL) return 0;
+
+  for (ix = 0; ix < tp->rows.nrows; ix++) {
+    row *rp = tp->rows.rows + ix;
+
+    if (!write_cube(cov, rp->base, rp->mask, 1)) {
+      free_image(cov);
+      return 0;
+    }
+  }
+
+  psize = 1 << cov->pbits;
+  for (pnum = 0; pnum < cov->npages; pnum++) {
+    for (ix = 0; ix < psize; ix++) {
+      addr = (pnum << cov->pbits) + ix;
+      if (cov->page[pnum] == NULL || cov->page[pnum][ix] == 0)
+        ADD_SET(holes, addr);
+    }
+  }
+
+  free_image(cov);
+
+  return 1;
+
+} /* end find_holes() */
+
+/* Here there be dragons */
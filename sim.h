@@ -0,0 +1,142 @@
+/*
+  sim.h
+
+  Running the state machine a truth table describes, from the ROM
+  images compiled for it, for tt2rom version 2.
+ */
+
+#ifndef _H_SIM_
+#define _H_SIM_
+
+#include "libtt2rom.h"
+
+/* Results from make_machine() */
+#define SIM_OK 0      /* machine was made successfully      */
+#define SIM_MEMORY 1  /* memory could not be had            */
+#define SIM_BADSPEC 2 /* feedback does not fit the table    */
+
+/* A state machine whose next state is read from its ROMs: some of the
+   address bits (the state bits) are fed back from output bits of the
+   ROMs, and the rest (the input bits) are given at each step.  The
+   state bits every address gives are found once, when the machine is
+   made, so that a step is a single look-up in 'next'.
+ */
+typedef struct {
+  int abits;     /* number of address bits                 */
+  address state; /* address bits fed back from the outputs */
+  address input; /* address bits given at each step        */
+  int nin;       /* number of input bits                   */
+  address *next; /* state bits given at each address       */
+} machine;
+
+/* Make the machine for a table whose ROM images have been filled in,
+   with the feedback given by 'spec': a list of pairs separated by
+   commas, each of the form "a=id:b", meaning that address bit 'a' is
+   fed from bit 'b' of the word of ROM 'id', given by number or name
+   as on the configuration line.  Bits are numbered from 0 for the
+   least significant, as the ROMs' pins see them.  Each address bit
+   may be fed only once.  Memory for an entry per address is needed.
+   Returns one of the SIM_xxx codes above; the machine must be
+   released with free_machine() whether or not this succeeds.
+ */
+int make_machine(tt_table *tp, char *spec, machine *mp);
+
+/* Release the memory used by a machine */
+void free_machine(machine *mp);
+
+/* The inputs of a machine for a number of steps */
+typedef struct {
+  address in;          /* input bits, in their places */
+  unsigned long count; /* steps they are held for     */
+} vector;
+
+/* Parse an input vector from 'line', which has had comments and
+   whitespace removed: the input bits as '0' or '1', most significant
+   first, optionally followed by "*n" to hold them for 'n' steps.
+   Returns true if successful, false if the line is not well formed
+   or does not have one bit for each input.
+ */
+int parse_vector(machine *mp, char *line, vector *vp);
+
+/* A run of a machine, through its vectors in order from 'start' */
+typedef struct {
+  vector *vec;   /* the inputs               */
+  int nvec;      /* ... how many vectors     */
+  address start; /* state bits to start with */
+  address end;   /* state bits at the end    */
+  double steps;  /* steps taken              */
+} simrun;
+
+/* A set of addresses, as a bitmap: address 'a' is bit (a % WORD_BITS)
+   of word (a / WORD_BITS).  A set of all the addresses of 'n' bits has
+   SET_WORDS(n) words.
+ */
+typedef unsigned long bitword;
+
+#define WORD_BITS ((int)(sizeof(bitword) * CHAR_BIT))
+#define SET_WORDS(n) \
+  (((size_t)1 << (n)) < (size_t)WORD_BITS ? 1 : ((size_t)1 << (n)) / WORD_BITS)
+
+/* Is address 'a' in a set?  Add it to one */
+#define IN_SET(set, a) (((set)[(a) / WORD_BITS] >> ((a) % WORD_BITS)) & 1)
+#define ADD_SET(set, a) \
+  ((set)[(a) / WORD_BITS] |= (bitword)1 << ((a) % WORD_BITS))
+
+/* Take each of the runs, which are independent of one another, and
+   store their end states and steps.  If 'nthreads' is greater than 1
+   (and thread support is available), the runs are shared among that
+   many threads.  If 'seen' is not NULL, it is a set of the addresses,
+   of SET_WORDS(abits) words, and the addresses visited by all the runs
+   are added to it.  Returns true if successful, false if memory could
+   not be had.
+ */
+int run_machine(machine *mp, simrun *runs, int nruns, int nthreads,
+                bitword *seen);
+
+/* Take up to 'max' steps of a run, storing the address at each step in
+   'addrs'.  Returns the number of steps taken.
+ */
+long trace_run(machine *mp, simrun *rp, address *addrs, long max);
+
+/* Count the addresses in the first 'nwords' words of a set */
+double count_set(bitword *set, size_t nwords);
+
+/* Find every state that can be reached from 'start', whatever the
+   inputs, by a breadth-first search of the machine, and add them to
+   'reached', a set of SET_WORDS(abits) words that is empty to begin
+   with.  A state is given as an address whose input bits are zero.
+   The states of each level of the search are shared among 'nthreads'
+   threads, if there are enough of them.  Returns the number of levels
+   of the search (the most steps any state needs), or -1 if memory
+   could not be had.
+ */
+long reach_states(machine *mp, address start, int nthreads,
+                  bitword *reached);
+
+/* Called with each cube of addresses found by the functions below,
+   as a base address and a mask of its don't-care bits
+ */
+typedef void (*cube_func)(void *arg, address base, address mask);
+
+/* Divide the set 'set' of all the addresses of 'abits' bits into
+   cubes, calling 'report' for each one.  The cubes do not overlap,
+   and are found by splitting the set on its most significant bit and
+   taking the addresses that are on both sides together.  Returns true
+   if successful, false if memory could not be had.
+ */
+int find_cubes(bitword *set, int abits, cube_func report, void *arg);
+
+/* Report the states of a machine that are not in 'reached' as cubes,
+   as find_cubes() does, with the input bits as don't-cares.  Returns
+   true if successful, false if memory could not be had.
+ */
+int unreached_states(machine *mp, bitword *reached, cube_func report,
+                     void *arg);
+
+/* Add the addresses no row of the table covers to 'holes', a set of
+   SET_WORDS(abits) words.  Returns true if successful, false if
+   memory could not be had.
+ */
+int find_holes(tt_table *tp, bitword *holes);
+
+#endif /* end _H_SIM_ */
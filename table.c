@@ -0,0 +1,1170 @@
+/*
+  table.c
+
+  Routines for compiling the lines of a truth table into ROM data, for
+  tt2rom version 2.
+ */
+
+#include "table.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "text.h"
+
+#define COMMENT_CHAR '#'
+#define OUTPUT_DC '-' /* output "don't care" indicator */
+#define MIN_ROWS 64   /* initial allocation for a rowset */
+#define SLICES 4      /* address space slices per thread */
+#define MIN_NODES 256 /* initial allocation for a trie   */
+#define DC_BRANCH 2   /* trie branch for don't-care bits */
+#define BUCKET_ROWS 8 /* rows in a trie node before split */
+#define MIN_LIST 64   /* initial allocation for list_rows() */
+#define BATCH_ROWS 256 /* rows handed to expander threads at once */
+#define QUEUE_BATCHES 16 /* batches an expander may fall behind */
+
+/* A group of columns of the configuration line, all of one class */
+typedef struct {
+  int cls;    /* ROM number, COL_ADDR, or COL_NAMED */
+  char *name; /* for COL_NAMED, the name...         */
+  int nlen;   /* ... and its length                 */
+  int count;  /* number of columns in the group     */
+} group;
+
+#define COL_NAMED (-2) /* group class for a ROM given by name */
+#define MAX_GROUP 65535 /* most columns in a bracketed group   */
+#define MAX_PINS 64     /* most pins of an address or a word   */
+
+/* Is 'ch' a character of a ROM name? */
+#define NAME_CHAR(ch) (isalnum((int)(ch)) || (ch) == '_')
+
+/*
+  Read the group of columns at '*pos', and move '*pos' past it.  ROM
+  numbers of 'maxroms' or more are all given as 'maxroms'.  Returns 1
+  if a group was read, 0 at the end of the line, or -1 if the line is
+  not well formed there.
+ */
+static int next_group(char **pos, int maxroms, group *gp) {
+  char *cp = *pos, *end;
+  long count = 1;
+
+  if (*cp == '\0') return 0;
+
+  gp->name = NULL;
+  gp->nlen = 0;
+
+  if (*cp != '[') {
+    if (isdigit((int)*cp))
+      gp->cls = *cp - '0';
+    else if (*cp == 'A' || *cp == 'a')
+      gp->cls = COL_ADDR;
+    else
+      return -1;
+
+    gp->count = 1;
+    *pos = cp + 1;
+    return 1;
+  }
+
+  for (end = ++cp; NAME_CHAR(*end);) ++end;
+  if (end == cp) return -1;
+
+  if (end - cp == 1 && (*cp == 'A' || *cp == 'a')) {
+    gp->cls = COL_ADDR;
+  } else if (isdigit((int)*cp)) {
+    for (gp->cls = 0; cp < end; cp++) {
+      if (!isdigit((int)*cp)) return -1;
+      if (gp->cls < maxroms) gp->cls = gp->cls * 10 + (*cp - '0');
+    }
+    if (gp->cls > maxroms) gp->cls = maxroms;
+  } else {
+    gp->cls = COL_NAMED;
+    gp->name = cp;
+    gp->nlen = end - cp;
+  }
+
+  if (*end == ':') {
+    if (!isdigit((int)end[1])) return -1;
+    count = strtol(end + 1, &end, 10);
+    if (count < 1 || count > MAX_GROUP) return -1;
+  }
+  if (*end != ']') return -1;
+
+  gp->count = (int)count;
+  *pos = end + 1;
+
+  return 1;
+
+} /* end next_group() */
+
+/*
+  The line is read twice: first to check it and count its columns, and
+  to find the highest ROM number, after which the names are numbered;
+  then to give each column its class, numbering the names as they are
+  found.  The columns of each ROM are then counted, to size its word;
+  and each column is given its byte and bit, counting down from the
+  most significant bit of the word, so that scan_line() need only set
+  them, however long the line is.
+ */
+int make_layout(char *config, int maxroms, layout *lp) {
+  int ix, cls, res, many = 0, *left;
+  char *pos;
+  group g;
+
+  lp->width = lp->abits = lp->nroms = lp->nbytes = 0;
+  lp->names = NULL;
+  lp->cls = NULL;
+  lp->pos = NULL;
+  lp->bit = NULL;
+  lp->off = NULL;
+  lp->wbytes = NULL;
+
+  if ((lp->config = malloc(strlen(config) + 1)) == NULL) return LAYOUT_MEMORY;
+  strcpy(lp->config, config);
+
+  for (pos = config; (res = next_group(&pos, maxroms, &g)) > 0;) {
+    if (g.count > INT_MAX - 1 - lp->width) return LAYOUT_BADCHAR;
+    lp->width += g.count;
+
+    if (g.cls == COL_ADDR)
+      lp->abits += g.count;
+    else if (g.cls >= maxroms)
+      many = 1;
+    else if (g.cls >= lp->nroms)
+      lp->nroms = g.cls + 1;
+  }
+
+  if (res < 0) return LAYOUT_BADCHAR;
+  if (many) return LAYOUT_MANY;
+
+  lp->cls = malloc(lp->width + 1);
+  lp->pos = malloc((lp->width + 1) * sizeof(int));
+  lp->bit = malloc(lp->width + 1);
+  lp->names = calloc(maxroms, sizeof(char *));
+
+  if (lp->cls == NULL || lp->pos == NULL || lp->bit == NULL ||
+      lp->names == NULL)
+    return LAYOUT_MEMORY;
+
+  for (ix = 0, pos = config; next_group(&pos, maxroms, &g) > 0;) {
+    if ((cls = g.cls) == COL_NAMED) {
+      for (cls = 0; cls < lp->nroms; cls++)
+        if (lp->names[cls] != NULL && (int)strlen(lp->names[cls]) == g.nlen &&
+            strncmp(lp->names[cls], g.name, g.nlen) == 0)
+          break;
+
+      if (cls == lp->nroms) {
+        if (cls == maxroms) return LAYOUT_MANY;
+        if ((lp->names[cls] = malloc(g.nlen + 1)) == NULL)
+          return LAYOUT_MEMORY;
+
+        memcpy(lp->names[cls], g.name, g.nlen);
+        lp->names[cls][g.nlen] = '\0';
+        ++lp->nroms;
+      }
+    }
+
+    while (g.count-- > 0) lp->cls[ix++] = (signed char)cls;
+  }
+
+  lp->off = calloc(lp->nroms + 1, sizeof(int));
+  lp->wbytes = calloc(lp->nroms + 1, sizeof(int));
+  left = calloc(lp->nroms + 1, sizeof(int));
+
+  if (lp->off == NULL || lp->wbytes == NULL || left == NULL) {
+    free(left);
+    return LAYOUT_MEMORY;
+  }
+
+  for (ix = 0; ix < lp->width; ix++)
+    if (lp->cls[ix] != COL_ADDR) ++left[(int)lp->cls[ix]];
+
+  for (cls = 0; cls < lp->nroms; cls++) {
+    if (left[cls] == 0) continue;
+
+    for (lp->wbytes[cls] = 1; lp->wbytes[cls] * CHAR_BIT < left[cls];)
+      lp->wbytes[cls] *= 2;
+
+    lp->off[cls] = lp->nbytes;
+    lp->nbytes += lp->wbytes[cls];
+  }
+
+  for (ix = 0, cls = lp->abits; ix < lp->width; ix++) {
+    if (lp->cls[ix] == COL_ADDR) lp->pos[ix] = --cls;
+  }
+
+  for (ix = 0; ix < lp->width; ix++) {
+    if ((cls = lp->cls[ix]) == COL_ADDR) continue;
+
+    --left[cls];
+    lp->pos[ix] = lp->off[cls] + left[cls] / CHAR_BIT;
+    lp->bit[ix] = (byte)(1 << (left[cls] % CHAR_BIT));
+  }
+
+  free(left);
+
+  return LAYOUT_OK;
+
+} /* end make_layout() */
+
+/* Wire one group of a pin spec, starting at '*spec', and move '*spec'
+   past it.  'wired' has a flag for the address and each ROM, set as
+   its group is wired, so that no ID is given two groups.  Returns true
+   if successful, false if the group is not well formed or does not
+   fit the layout.
+ */
+static int wire_group(layout *lp, char **specp, char *wired) {
+  char used[MAX_PINS], *end, *spec = *specp;
+  int ix, jx, cls, count, npins, pins[MAX_PINS];
+
+  /* Which columns the group is for */
+  for (end = spec; NAME_CHAR(*end);) ++end;
+  if (end == spec || *end != ':') return 0;
+
+  if (end - spec == 1 && (*spec == 'A' || *spec == 'a')) {
+    cls = COL_ADDR;
+  } else if (isdigit((int)*spec)) {
+    long num = strtol(spec, &spec, 10);
+
+    if (spec != end) return 0;
+    cls = (num < lp->nroms) ? (int)num : lp->nroms;
+  } else {
+    for (cls = 0; cls < lp->nroms; cls++)
+      if (lp->names[cls] != NULL &&
+          (int)strlen(lp->names[cls]) == end - spec &&
+          strncmp(lp->names[cls], spec, end - spec) == 0)
+        break;
+  }
+
+  if (cls == COL_ADDR)
+    npins = lp->abits;
+  else if (cls < lp->nroms && lp->wbytes[cls] > 0)
+    npins = lp->wbytes[cls] * CHAR_BIT;
+  else
+    return 0;
+
+  if (npins > MAX_PINS || wired[cls + 1]) return 0;
+  wired[cls + 1] = 1;
+
+  /* The pins, each within range and used only once */
+  memset(used, 0, sizeof(used));
+  for (count = 0, spec = end; *spec == ':' || *spec == ',';) {
+    long pin;
+
+    if (!isdigit((int)spec[1])) return 0;
+    pin = strtol(spec + 1, &spec, 10);
+    if (pin >= npins || used[pin]) return 0;
+
+    used[pin] = 1;
+    pins[count++] = (int)pin;
+  }
+  if (*spec == ';')
+    ++spec;
+  else if (*spec != '\0')
+    return 0;
+
+  /* One for each column of the group, given from left to right */
+  for (ix = jx = 0; ix < lp->width; ix++)
+    if (lp->cls[ix] == cls) ++jx;
+  if (jx != count) return 0;
+
+  for (ix = jx = 0; ix < lp->width; ix++) {
+    if (lp->cls[ix] != cls) continue;
+
+    if (cls == COL_ADDR) {
+      lp->pos[ix] = pins[jx++];
+    } else {
+      lp->pos[ix] = lp->off[cls] + pins[jx] / CHAR_BIT;
+      lp->bit[ix] = (byte)(1 << (pins[jx] % CHAR_BIT));
+      ++jx;
+    }
+  }
+
+  *specp = spec;
+
+  return 1;
+
+} /* end wire_group() */
+
+/*
+  Each group is checked and applied in turn.  Only the columns' entries
+  in the layout change, so the pins cost nothing as lines are compiled:
+  the bits of each line go straight to their pins.
+ */
+int wire_layout(layout *lp, char *spec) {
+  char *wired;
+  int ok = 1;
+
+  if ((wired = calloc(lp->nroms + 1, 1)) == NULL) return 0;
+
+  while (*spec != '\0' && ok) ok = wire_group(lp, &spec, wired);
+
+  free(wired);
+
+  return ok;
+
+} /* end wire_layout() */
+
+void free_layout(layout *lp) {
+  int ix;
+
+  if (lp->names != NULL)
+    for (ix = 0; ix < lp->nroms; ix++) free(lp->names[ix]);
+
+  free(lp->config);
+  free(lp->names);
+  free(lp->cls);
+  free(lp->pos);
+  free(lp->bit);
+  free(lp->off);
+  free(lp->wbytes);
+
+  lp->config = NULL;
+  lp->names = NULL;
+  lp->cls = NULL;
+  lp->pos = NULL;
+  lp->bit = NULL;
+  lp->off = NULL;
+  lp->wbytes = NULL;
+
+} /* end free_layout() */
+
+/*
+  Each character is classified by a single switch, which the compiler
+  can turn into a table jump, and each column's ROM, byte and bit are
+  looked up in the layout, so the cost of a line grows only with its
+  length.  Errors do not stop the scan; they are noted, and reported in
+  order of precedence at the end, so that the result is the same as
+  checking for each kind of error separately.
+ */
+int scan_line(char *line, layout *lp, char odcv, address *base,
+              address *mask, byte *data, int *len) {
+  address b = 0, m = 0;
+  int col = 0, bad = 0, datadc = 0;
+  int dcbit = (odcv == '1');
+
+  memset(data, 0, lp->nbytes);
+
+  while (*line != '\0' && *line != COMMENT_CHAR) {
+    int bit; /* value of this column, or -1 for don't-care */
+
+    switch (*line++) {
+      case ' ':
+      case '\t':
+      case '\n':
+      case '\v':
+      case '\f':
+      case '\r':
+        continue;
+
+      case '0':
+        bit = 0;
+        break;
+      case '1':
+        bit = 1;
+        break;
+      case OUTPUT_DC:
+        bit = dcbit;
+        break;
+      case 'x':
+      case 'X':
+        bit = -1;
+        break;
+
+      default:
+        bad = 1;
+        ++col;
+        continue;
+    }
+
+    if (col < lp->width) {
+      int cls = lp->cls[col];
+
+      if (cls == COL_ADDR) {
+        address pin = (address)1 << lp->pos[col];
+
+        if (bit < 0)
+          m |= pin;
+        else if (bit)
+          b |= pin;
+
+      } else if (bit < 0) {
+        datadc = 1;
+
+      } else if (bit) {
+        data[lp->pos[col]] |= lp->bit[col];
+      }
+    }
+    ++col;
+  }
+
+  *base = b;
+  *mask = m;
+  *len = col;
+
+  if (col == 0) return SCAN_BLANK;
+  if (bad) return SCAN_BADCHAR;
+  if (col != lp->width) return SCAN_LENGTH;
+  if (datadc) return SCAN_DATADC;
+
+  return SCAN_OK;
+
+} /* end scan_line() */
+
+void init_rows(rowset *rs, int nbytes) {
+  rs->nbytes = nbytes;
+  rs->nrows = rs->nalloc = 0;
+  rs->rows = NULL;
+  rs->data = NULL;
+
+} /* end init_rows() */
+
+void free_rows(rowset *rs) {
+  if (rs->rows) free(rs->rows);
+  if (rs->data) free(rs->data);
+
+  init_rows(rs, rs->nbytes);
+
+} /* end free_rows() */
+
+int add_row(rowset *rs, address base, address mask, byte *data, int line) {
+  row *rp;
+
+  /* Double the allocation when it is used up */
+  if (rs->nrows == rs->nalloc) {
+    int nalloc = rs->nalloc ? 2 * rs->nalloc : MIN_ROWS;
+    row *rows;
+    byte *words;
+
+    if ((rows = realloc(rs->rows, nalloc * sizeof(row))) == NULL) return 0;
+    rs->rows = rows;
+
+    if ((words = realloc(rs->data, nalloc * rs->nbytes)) == NULL) return 0;
+    rs->data = words;
+
+    rs->nalloc = nalloc;
+  }
+
+  rp = rs->rows + rs->nrows;
+  rp->base = base;
+  rp->mask = mask;
+  rp->line = line;
+  memcpy(rs->data + rs->nrows * rs->nbytes, data, rs->nbytes);
+  ++rs->nrows;
+
+  return 1;
+
+} /* end add_row() */
+
+/* Write 'nrows' rows, with their 'nbytes' bytes of data each at
+   'rdata', into the part of each image named in 'slot' that lies
+   within the cube (sbase, smask), clipping each row to fit.  Returns
+   false if memory for the images could not be had.
+ */
+static int write_rows(row *rows, byte *rdata, int nrows, int nbytes,
+                      image **slot, address sbase, address smask) {
+  address base, mask;
+  int ix, jx;
+
+  for (ix = 0; ix < nrows; ix++) {
+    row *rp = rows + ix;
+    byte *data = rdata + ix * nbytes;
+
+    if (!cube_intersect(rp->base, rp->mask, sbase, smask, &base, &mask))
+      continue;
+
+    for (jx = 0; jx < nbytes;) {
+      image *img = slot[jx];
+
+      if (img == NULL) {
+        ++jx;
+      } else if (img->width == 1) {
+        if (!write_cube(img, base, mask, data[jx++])) return 0;
+      } else {
+        if (!write_words(img, base, mask, data + jx)) return 0;
+        jx += img->width;
+      }
+    }
+  }
+
+  return 1;
+
+} /* end write_rows() */
+
+/* Write all the rows of a set into the part of each ROM image that
+   lies within the cube (sbase, smask)
+ */
+#define APPLY_SLICE(RS, SLOT, SB, SM) \
+  write_rows((RS)->rows, (RS)->data, (RS)->nrows, (RS)->nbytes, SLOT, SB, SM)
+
+#ifdef USE_THREADS
+
+/* How many bits of the address select a slice, when the work is
+   shared by 'nthreads' threads: a few slices per thread, so that an
+   uneven division of the work among the slices does not leave threads
+   idle, but no slice smaller than a page
+ */
+static int slice_bits(int abits, int nthreads) {
+  int sbits = 0;
+
+  while (sbits < abits - PAGE_BITS && (1 << sbits) < SLICES * nthreads)
+    ++sbits;
+
+  return sbits;
+
+} /* end slice_bits() */
+
+/* Work shared by the threads of apply_rows() */
+typedef struct {
+  rowset *rs;
+  image **slot;
+  int shift;   /* slice number is address >> shift */
+  int nslices; /* number of slices                 */
+  int next;    /* next slice to be filled          */
+  int ok;      /* false if any slice failed        */
+  pthread_mutex_t lock;
+} slicework;
+
+/* Each slice is a run of addresses sharing the same high-order bits,
+   and is made up of whole pages, so no two threads ever write to (or
+   allocate) the same page, and the image needs no locking.  Within a
+   slice the rows are applied in order.
+ */
+static void *slice_worker(void *arg) {
+  slicework *sw = arg;
+  address smask = LOW_BITS(sw->shift);
+
+  while (1) {
+    int slice;
+
+    pthread_mutex_lock(&sw->lock);
+    slice = sw->next++;
+    pthread_mutex_unlock(&sw->lock);
+
+    if (slice >= sw->nslices) break;
+
+    if (!APPLY_SLICE(sw->rs, sw->slot, (address)slice << sw->shift, smask)) {
+      pthread_mutex_lock(&sw->lock);
+      sw->ok = 0;
+      sw->next = sw->nslices;
+      pthread_mutex_unlock(&sw->lock);
+    }
+  }
+
+  return NULL;
+
+} /* end slice_worker() */
+
+#endif /* USE_THREADS */
+
+int apply_rows(rowset *rs, image **slot, int abits, int nthreads) {
+#ifdef USE_THREADS
+  slicework sw;
+  pthread_t *tids;
+  int ix, nstarted = 0, sbits = slice_bits(abits, nthreads);
+
+  if (nthreads > 1 && sbits > 0 &&
+      (tids = calloc(nthreads, sizeof(pthread_t))) != NULL) {
+    sw.rs = rs;
+    sw.slot = slot;
+    sw.shift = abits - sbits;
+    sw.nslices = 1 << sbits;
+    sw.next = 0;
+    sw.ok = 1;
+    pthread_mutex_init(&sw.lock, NULL);
+
+    for (ix = 1; ix < nthreads; ix++) {
+      if (pthread_create(tids + nstarted, NULL, slice_worker, &sw) != 0) break;
+      ++nstarted;
+    }
+
+    /* This thread does its share too, and finishes anything the others
+       do not get to (if some of them could not be started)
+     */
+    slice_worker(&sw);
+
+    for (ix = 0; ix < nstarted; ix++) pthread_join(tids[ix], NULL);
+
+    pthread_mutex_destroy(&sw.lock);
+    free(tids);
+    return sw.ok;
+  }
+#endif /* USE_THREADS */
+
+  /* The whole address space as a single slice */
+  return APPLY_SLICE(rs, slot, 0, LOW_BITS(abits));
+
+} /* end apply_rows() */
+
+#ifdef USE_THREADS
+
+/* A batch of rows in an expander's queue */
+typedef struct {
+  int nrows;  /* rows in the batch              */
+  row *rows;  /* room for BATCH_ROWS rows       */
+  byte *data; /* ... and for their data words   */
+} batch;
+
+/* One of the threads of an expander */
+typedef struct {
+  expander *ep;
+  int num;     /* fills slices num, num + nthreads, ... */
+  long taken;  /* batches finished by this thread       */
+  pthread_t tid;
+} filler;
+
+/*
+  The batches form a ring, which the thread compiling the table fills
+  in order.  Every filler thread goes through every batch, writing the
+  rows into the slices of the address space it owns, so the rows reach
+  each address in order.  A batch is reused once all the fillers are
+  done with it.  The lock is taken once per batch, not once per row.
+ */
+struct expander {
+  image **slot;
+  int nbytes;   /* data bytes per row               */
+  int shift;    /* slice number is address >> shift */
+  int nslices;  /* number of slices                 */
+  int nthreads; /* filler threads running           */
+  filler *fill;
+  batch queue[QUEUE_BATCHES];
+  long given;   /* batches handed to the fillers    */
+  int closed;   /* will any more batches be given?  */
+  int ok;       /* false if any slice failed        */
+  byte *space;  /* memory for the batches           */
+  pthread_mutex_t lock;
+  pthread_cond_t ready; /* a batch was given, or closed */
+  pthread_cond_t room;  /* a filler finished a batch    */
+};
+
+static void *fill_worker(void *arg) {
+  filler *fp = arg;
+  expander *ep = fp->ep;
+  address smask = LOW_BITS(ep->shift);
+  batch *bp;
+  int slice, ok;
+
+  while (1) {
+    pthread_mutex_lock(&ep->lock);
+    while (fp->taken == ep->given && !ep->closed)
+      pthread_cond_wait(&ep->ready, &ep->lock);
+
+    if (fp->taken == ep->given) {
+      pthread_mutex_unlock(&ep->lock);
+      break;
+    }
+    ok = ep->ok;
+    pthread_mutex_unlock(&ep->lock);
+
+    /* Once memory has run out, batches are only passed over */
+    bp = ep->queue + fp->taken % QUEUE_BATCHES;
+    for (slice = fp->num; ok && slice < ep->nslices; slice += ep->nthreads)
+      ok = write_rows(bp->rows, bp->data, bp->nrows, ep->nbytes, ep->slot,
+                      (address)slice << ep->shift, smask);
+
+    pthread_mutex_lock(&ep->lock);
+    if (!ok) ep->ok = 0;
+    ++fp->taken;
+    pthread_cond_broadcast(&ep->room);
+    pthread_mutex_unlock(&ep->lock);
+  }
+
+  return NULL;
+
+} /* end fill_worker() */
+
+/* Hand the batch being filled to the fillers, and wait until the next
+   one is free
+ */
+static void give_batch(expander *ep) {
+  long oldest;
+  int ix;
+
+  pthread_mutex_lock(&ep->lock);
+  ++ep->given;
+  pthread_cond_broadcast(&ep->ready);
+
+  while (1) {
+    for (oldest = ep->given, ix = 0; ix < ep->nthreads; ix++)
+      if (ep->fill[ix].taken < oldest) oldest = ep->fill[ix].taken;
+
+    if (ep->given - oldest < QUEUE_BATCHES) break;
+
+    pthread_cond_wait(&ep->room, &ep->lock);
+  }
+  pthread_mutex_unlock(&ep->lock);
+
+  ep->queue[ep->given % QUEUE_BATCHES].nrows = 0;
+
+} /* end give_batch() */
+
+expander *start_expander(image **slot, int nbytes, int abits, int nthreads) {
+  size_t bsize = BATCH_ROWS * (sizeof(row) + nbytes);
+  expander *ep;
+  int ix, sbits;
+
+  if (nthreads < 1) nthreads = 1;
+
+  sbits = slice_bits(abits, nthreads);
+  if (nthreads > (1 << sbits)) nthreads = 1 << sbits;
+
+  if ((ep = malloc(sizeof(expander))) == NULL) return NULL;
+
+  if ((ep->fill = calloc(nthreads, sizeof(filler))) == NULL ||
+      (ep->space = malloc(QUEUE_BATCHES * bsize)) == NULL) {
+    free(ep->fill);
+    free(ep);
+    return NULL;
+  }
+
+  /* The rows come first in each batch, so they are aligned */
+  for (ix = 0; ix < QUEUE_BATCHES; ix++) {
+    ep->queue[ix].nrows = 0;
+    ep->queue[ix].rows = (row *)(ep->space + ix * bsize);
+    ep->queue[ix].data = ep->space + ix * bsize + BATCH_ROWS * sizeof(row);
+  }
+
+  ep->slot = slot;
+  ep->nbytes = nbytes;
+  ep->shift = abits - sbits;
+  ep->nslices = 1 << sbits;
+  ep->given = 0;
+  ep->closed = 0;
+  ep->ok = 1;
+  pthread_mutex_init(&ep->lock, NULL);
+  pthread_cond_init(&ep->ready, NULL);
+  pthread_cond_init(&ep->room, NULL);
+
+  /* No batch is given until this returns, so if fewer threads could be
+     started than were wanted, those that were can share the slices
+   */
+  for (ep->nthreads = 0; ep->nthreads < nthreads; ep->nthreads++) {
+    filler *fp = ep->fill + ep->nthreads;
+
+    fp->ep = ep;
+    fp->num = ep->nthreads;
+    fp->taken = 0;
+    if (pthread_create(&fp->tid, NULL, fill_worker, fp) != 0) break;
+  }
+
+  if (ep->nthreads == 0) {
+    ep->closed = 1;
+    finish_expander(ep);
+    return NULL;
+  }
+
+  return ep;
+
+} /* end start_expander() */
+
+void expand_row(expander *ep, address base, address mask, byte *data) {
+  batch *bp = ep->queue + ep->given % QUEUE_BATCHES;
+  row *rp = bp->rows + bp->nrows;
+
+  rp->base = base;
+  rp->mask = mask;
+  rp->line = 0;
+  memcpy(bp->data + bp->nrows * ep->nbytes, data, ep->nbytes);
+
+  if (++bp->nrows == BATCH_ROWS) give_batch(ep);
+
+} /* end expand_row() */
+
+int finish_expander(expander *ep) {
+  int ix, ok;
+
+  if (ep->queue[ep->given % QUEUE_BATCHES].nrows > 0) give_batch(ep);
+
+  pthread_mutex_lock(&ep->lock);
+  ep->closed = 1;
+  pthread_cond_broadcast(&ep->ready);
+  pthread_mutex_unlock(&ep->lock);
+
+  for (ix = 0; ix < ep->nthreads; ix++) pthread_join(ep->fill[ix].tid, NULL);
+
+  pthread_mutex_destroy(&ep->lock);
+  pthread_cond_destroy(&ep->ready);
+  pthread_cond_destroy(&ep->room);
+
+  ok = ep->ok;
+  free(ep->space);
+  free(ep->fill);
+  free(ep);
+
+  return ok;
+
+} /* end finish_expander() */
+
+#else /* USE_THREADS */
+
+expander *start_expander(image **slot, int nbytes, int abits, int nthreads) {
+  return NULL;
+
+} /* end start_expander() */
+
+void expand_row(expander *ep, address base, address mask, byte *data) {}
+
+int finish_expander(expander *ep) { return 1; }
+
+#endif /* USE_THREADS */
+
+/* A node of a row index.  A node is either a bucket of rows, chained
+   through 'next' from 'rows', or it has a branch for each value the
+   next address bit may have in a row: 0, 1, or don't-care.  Nodes
+   start out as buckets, and are split into branches when they grow too
+   big, so that the deep, sparse parts of the trie are scanned instead
+   of walked a bit at a time.
+ */
+typedef struct {
+  int child[3]; /* branches, or -1                      */
+  int rows;     /* first row in the bucket, or -1       */
+  int nrows;    /* rows in the bucket, or -1 if split   */
+  int last;     /* highest row under the node, or -1    */
+} tnode;
+
+struct rowindex {
+  rowset *rs;
+  int abits;
+  tnode *node; /* node 0 is the root */
+  int nnodes;
+  int nalloc;
+  int *next; /* next row in the same bucket, or -1 */
+};
+
+/* Add an empty bucket to an index, returning its number, or -1 if
+   memory could not be had.  The node array may move.
+ */
+static int new_node(rowindex *xp) {
+  tnode *np;
+
+  if (xp->nnodes == xp->nalloc) {
+    int nalloc = xp->nalloc ? 2 * xp->nalloc : MIN_NODES;
+
+    if ((np = realloc(xp->node, nalloc * sizeof(tnode))) == NULL) return -1;
+
+    xp->node = np;
+    xp->nalloc = nalloc;
+  }
+
+  np = xp->node + xp->nnodes;
+  np->child[0] = np->child[1] = np->child[DC_BRANCH] = -1;
+  np->rows = -1;
+  np->nrows = 0;
+  np->last = -1;
+
+  return xp->nnodes++;
+
+} /* end new_node() */
+
+/* Set up an index with no rows in it yet.  Returns false if memory
+   could not be had.
+ */
+static int init_index(rowindex *xp, rowset *rs, int abits) {
+  xp->rs = rs;
+  xp->abits = abits;
+  xp->node = NULL;
+  xp->nnodes = xp->nalloc = 0;
+
+  if ((xp->next = malloc((rs->nrows + 1) * sizeof(int))) == NULL) return 0;
+
+  if (new_node(xp) < 0) {
+    free(xp->next);
+    return 0;
+  }
+
+  return 1;
+
+} /* end init_index() */
+
+/* The branch a cube takes at an address bit */
+#define BRANCH(BASE, MASK, B) \
+  ((((MASK) >> (B)) & 1) ? DC_BRANCH : (int)(((BASE) >> (B)) & 1))
+
+/* Call 'fn' for each row under node 'nd', which branches on address
+   bit 'bit', whose cube meets the cube (base, mask).  Only the
+   branches that could meet it are followed: a 0 or 1 bit in the cube
+   matches the same value or a don't-care, and a don't-care matches
+   anything.
+ */
+static void search_trie(rowindex *xp, int nd, int bit, address base,
+                        address mask, row_func fn, void *arg) {
+  rowset *rs = xp->rs;
+  tnode *np = xp->node + nd;
+  address ib, im;
+  int br, jx;
+
+  if (np->nrows >= 0) {
+    for (jx = np->rows; jx >= 0; jx = xp->next[jx]) {
+      row *rp = rs->rows + jx;
+
+      if (cube_intersect(rp->base, rp->mask, base, mask, &ib, &im))
+        fn(arg, rs, jx);
+    }
+    return;
+  }
+
+  br = BRANCH(base, mask, bit);
+
+  if (br == DC_BRANCH) {
+    if (np->child[0] >= 0)
+      search_trie(xp, np->child[0], bit - 1, base, mask, fn, arg);
+    if (np->child[1] >= 0)
+      search_trie(xp, np->child[1], bit - 1, base, mask, fn, arg);
+  } else if (np->child[br] >= 0) {
+    search_trie(xp, np->child[br], bit - 1, base, mask, fn, arg);
+  }
+
+  if (np->child[DC_BRANCH] >= 0)
+    search_trie(xp, np->child[DC_BRANCH], bit - 1, base, mask, fn, arg);
+
+} /* end search_trie() */
+
+/* Add row 'ix' to the bucket it belongs in, first splitting the bucket
+   into branches on address bit 'bit' if it is full.  A bucket at the
+   bottom of the trie holds rows with the same cube, and is never
+   split.  Returns false if memory could not be had.
+ */
+static int insert_trie(rowindex *xp, int nd, int bit, int ix) {
+  row *rp = xp->rs->rows + ix;
+  int br, jx, kid;
+
+  while (1) {
+    if (ix > xp->node[nd].last) xp->node[nd].last = ix;
+
+    if (xp->node[nd].nrows >= 0) break;
+
+    br = BRANCH(rp->base, rp->mask, bit);
+
+    if (xp->node[nd].child[br] < 0) {
+      if ((kid = new_node(xp)) < 0) return 0;
+      xp->node[nd].child[br] = kid;
+    }
+
+    nd = xp->node[nd].child[br];
+    --bit;
+  }
+
+  if (xp->node[nd].nrows == BUCKET_ROWS && bit >= 0) {
+    jx = xp->node[nd].rows;
+    xp->node[nd].rows = -1;
+    xp->node[nd].nrows = -1;
+
+    while (jx >= 0) {
+      int nx = xp->next[jx];
+
+      if (!insert_trie(xp, nd, bit, jx)) return 0;
+      jx = nx;
+    }
+
+    return insert_trie(xp, nd, bit, ix);
+  }
+
+  xp->next[ix] = xp->node[nd].rows;
+  xp->node[nd].rows = ix;
+  ++xp->node[nd].nrows;
+
+  return 1;
+
+} /* end insert_trie() */
+
+rowindex *index_rows(rowset *rs, int abits) {
+  rowindex *xp;
+  int ix;
+
+  if ((xp = malloc(sizeof(rowindex))) == NULL) return NULL;
+
+  if (!init_index(xp, rs, abits)) {
+    free(xp);
+    return NULL;
+  }
+
+  for (ix = 0; ix < rs->nrows; ix++) {
+    if (!insert_trie(xp, 0, abits - 1, ix)) {
+      free_index(xp);
+      return NULL;
+    }
+  }
+
+  return xp;
+
+} /* end index_rows() */
+
+void free_index(rowindex *xp) {
+  free(xp->node);
+  free(xp->next);
+  free(xp);
+
+} /* end free_index() */
+
+/* Find the highest row under node 'nd', which branches on address bit
+   'bit', that covers address 'addr' and is higher than '*best', and
+   store it in 'best'.  The branch with the higher last row is tried
+   first, and any node with no row higher than the best found so far
+   is passed over.
+ */
+static void last_in_trie(rowindex *xp, int nd, int bit, address addr,
+                         int *best) {
+  tnode *np = xp->node + nd;
+  int jx, a, b;
+
+  if (np->last <= *best) return;
+
+  if (np->nrows >= 0) {
+    for (jx = np->rows; jx >= 0; jx = xp->next[jx]) {
+      row *rp = xp->rs->rows + jx;
+
+      if (jx > *best && (addr & ~rp->mask) == rp->base) *best = jx;
+    }
+    return;
+  }
+
+  a = np->child[(addr >> bit) & 1];
+  b = np->child[DC_BRANCH];
+
+  if (a >= 0 && b >= 0 && xp->node[b].last > xp->node[a].last) {
+    jx = a;
+    a = b;
+    b = jx;
+  }
+
+  if (a >= 0) last_in_trie(xp, a, bit - 1, addr, best);
+  if (b >= 0) last_in_trie(xp, b, bit - 1, addr, best);
+
+} /* end last_in_trie() */
+
+int last_row(rowindex *xp, address addr) {
+  int best = -1;
+
+  last_in_trie(xp, 0, xp->abits - 1, addr, &best);
+
+  return best;
+
+} /* end last_row() */
+
+void find_rows(rowindex *xp, address base, address mask, row_func fn,
+               void *arg) {
+  search_trie(xp, 0, xp->abits - 1, base, mask, fn, arg);
+
+} /* end find_rows() */
+
+/* Rows being gathered by list_rows() */
+typedef struct {
+  int **rows;
+  int *nalloc;
+  int nrows;
+  int ok; /* false if memory ran out */
+} rowlist;
+
+static void list_row(void *arg, rowset *rs, int ix) {
+  rowlist *lp = arg;
+  int *rows;
+
+  if (!lp->ok) return;
+
+  if (lp->nrows == *lp->nalloc) {
+    int nalloc = *lp->nalloc ? 2 * *lp->nalloc : MIN_LIST;
+
+    if ((rows = realloc(*lp->rows, nalloc * sizeof(int))) == NULL) {
+      lp->ok = 0;
+      return;
+    }
+
+    *lp->rows = rows;
+    *lp->nalloc = nalloc;
+  }
+
+  (*lp->rows)[lp->nrows++] = ix;
+
+} /* end list_row() */
+
+static int cmp_rows(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+
+} /* end cmp_rows() */
+
+int list_rows(rowindex *xp, address base, address mask, int **rows,
+              int *nalloc) {
+  rowlist rl;
+
+  rl.rows = rows;
+  rl.nalloc = nalloc;
+  rl.nrows = 0;
+  rl.ok = 1;
+
+  search_trie(xp, 0, xp->abits - 1, base, mask, list_row, &rl);
+  if (!rl.ok) return -1;
+
+  if (rl.nrows > 1) qsort(*rows, rl.nrows, sizeof(int), cmp_rows);
+
+  return rl.nrows;
+
+} /* end list_rows() */
+
+/* What find_overlaps() is doing, for overlap_row() */
+typedef struct {
+  int ix; /* the row being looked up */
+  overlap_func report;
+  void *arg;
+  long count; /* pairs reported */
+} overlaps;
+
+/* Report row 'jx', which overlaps the row being looked up, if their
+   data words differ
+ */
+static void overlap_row(void *arg, rowset *rs, int jx) {
+  overlaps *op = arg;
+  row *first = rs->rows + jx, *second = rs->rows + op->ix;
+  address base, mask;
+
+  if (memcmp(rs->data + jx * rs->nbytes, rs->data + op->ix * rs->nbytes,
+             rs->nbytes) != 0) {
+    cube_intersect(first->base, first->mask, second->base, second->mask,
+                   &base, &mask);
+    op->report(op->arg, rs, jx, op->ix, base, mask);
+    ++op->count;
+  }
+
+} /* end overlap_row() */
+
+/*
+  Each row is looked up in an index of the rows before it, and then
+  added to it, so that every pair is found once.  A lookup visits only
+  the parts of the trie whose rows agree with it on the address bits
+  both fix, so the time taken grows with the number of rows times the
+  number of rows each one could overlap, rather than with the square
+  of the number of rows.
+ */
+long find_overlaps(rowset *rs, int abits, overlap_func report, void *arg) {
+  rowindex idx;
+  overlaps ov;
+
+  ov.report = report;
+  ov.arg = arg;
+  ov.count = 0;
+
+  if (!init_index(&idx, rs, abits)) return -1;
+
+  for (ov.ix = 0; ov.ix < rs->nrows; ov.ix++) {
+    row *rp = rs->rows + ov.ix;
+
+    search_trie(&idx, 0, abits - 1, rp->base, rp->mask, overlap_row, &ov);
+
+    if (!insert_trie(&idx, 0, abits - 1, ov.ix)) {
+      ov.count = -1;
+      break;
+    }
+  }
+
+  free(idx.node);
+  free(idx.next);
+
+  return ov.count;
+
+} /* end find_overlaps() */
+
+/* Here there be dragons */
@@ -0,0 +1,230 @@
+/*
+  table.h
+
+  Routines for compiling the lines of a truth table into ROM data, for
+  tt2rom version 2.
+ */
+
+#ifndef _H_TABLE_
+#define _H_TABLE_
+
+#include "rom.h"
+
+#define COL_ADDR (-1) /* column class for an address (state) bit */
+
+/* A layout records how the columns of each data line are to be
+   interpreted, as given by the configuration line of the file.
+
+   Each ROM's data word is as many bytes as its columns need, rounded
+   up to a power of two: 1, 2, 4, 8, and so on.  The words are packed
+   in the data of a row in order of ROM number, each stored least
+   significant byte first; the leftmost column of a ROM is the most
+   significant bit of its word.  ROM numbers with no columns take no
+   room at all.
+
+   A ROM given by name on the configuration line is numbered after the
+   highest ROM given by number, in the order the names first appear.
+
+   The address columns are the bits of the address, most significant
+   first, and a ROM's columns the bits of its word, unless the layout
+   has been wired otherwise by wire_layout().
+ */
+typedef struct {
+  char *config;     /* configuration line it came from  */
+  int width;        /* number of columns on each line   */
+  int abits;        /* number of address columns        */
+  int nroms;        /* highest ROM number in use, + 1   */
+  int nbytes;       /* bytes of data words per row      */
+  char **names;     /* name of each ROM, or NULL        */
+  signed char *cls; /* ROM number per column, COL_ADDR  */
+  int *pos;         /* byte of the row data per column, */
+                    /* or its bit of the address        */
+  byte *bit;        /* ... and its bit in that byte     */
+  int *off;         /* byte offset of each ROM's word   */
+  int *wbytes;      /* bytes in each ROM's word, or 0   */
+} layout;
+
+/* Results from scan_line(), in decreasing order of precedence */
+#define SCAN_OK 0      /* line was compiled successfully   */
+#define SCAN_BLANK 1   /* line has nothing but white space */
+#define SCAN_BADCHAR 2 /* line contains invalid characters */
+#define SCAN_LENGTH 3  /* wrong number of columns on line  */
+#define SCAN_DATADC 4  /* don't-care bit in an output      */
+
+/* Results from make_layout(), in decreasing order of precedence */
+#define LAYOUT_OK 0      /* layout was set up successfully      */
+#define LAYOUT_MEMORY 1  /* memory could not be had             */
+#define LAYOUT_BADCHAR 2 /* configuration is not well formed    */
+#define LAYOUT_MANY 3    /* ROM numbers run past 'maxroms' - 1  */
+
+/* Set up a layout from a configuration line, which has had comments
+   and whitespace removed.  Each character of the line is a column:
+   'A' (or 'a') for an address bit, or a digit for an output bit of
+   the ROM of that number.  A group of columns may also be written in
+   brackets, as "[id]" for one column or "[id:n]" for 'n' of them,
+   where the id is 'A', a ROM number of any length, or the name of a
+   ROM, made of letters, digits and underscores and not starting with
+   a digit.  ROM numbers must be less than 'maxroms'.  Returns one of
+   the LAYOUT_xxx codes above; the layout must be released with
+   free_layout() whether or not this succeeds.
+ */
+int make_layout(char *config, int maxroms, layout *lp);
+
+/* Route the columns of a layout to other pins of the ROMs, as given
+   by 'spec': a list of groups separated by semicolons, each of the
+   form "id:pin,pin,...".  The id is 'A' for the address, or a ROM
+   number or name, as on the configuration line; the pins are bit
+   numbers of the address or of the ROM's word (0 for the least
+   significant), one for each of its columns, from left to right.
+   Each id may be given only one group.  Address pins must each be
+   used once, and a ROM's pins at most once and within its word.
+   Returns true if successful, false if the spec is not well formed or
+   does not fit the layout.
+ */
+int wire_layout(layout *lp, char *spec);
+
+/* Release the memory used by a layout */
+void free_layout(layout *lp);
+
+/* Compile a single data line according to the given layout, in one
+   pass over the characters of the line.  Comments and whitespace are
+   skipped, output don't-care bits ('-') are replaced by 'odcv', the
+   address columns are compiled into 'base' and 'mask' (as for
+   compile_range(), but each column going to its pin of the address),
+   and the output bits are packed into 'data', which has room for the
+   layout's 'nbytes' bytes of data words.  The number of columns found
+   is stored in 'len'.
+
+   Returns one of the SCAN_xxx codes above; if a line has more than
+   one problem, the one listed first is reported.
+ */
+int scan_line(char *line, layout *lp, char odcv, address *base,
+              address *mask, byte *data, int *len);
+
+/* A compiled data line: the cube of addresses it covers, and where
+   it came from.  The data words for the row are kept separately.
+ */
+typedef struct {
+  address base;
+  address mask;
+  int line;
+} row;
+
+/* The rows of a table, in the order they appeared in the file.  The
+   data words of row 'ix' are the bytes data[ix * nbytes] ...
+   data[ix * nbytes + nbytes - 1], laid out as a layout describes.
+ */
+typedef struct {
+  int nbytes; /* data bytes per row  */
+  int nrows;  /* rows in use         */
+  int nalloc; /* rows allocated      */
+  row *rows;
+  byte *data;
+} rowset;
+
+/* Set up an empty set of rows with 'nbytes' bytes of data per row */
+void init_rows(rowset *rs, int nbytes);
+
+/* Release the memory used by a set of rows */
+void free_rows(rowset *rs);
+
+/* Append a row to the set, copying its data words.  Returns true if
+   successful, false if memory could not be had.
+ */
+int add_row(rowset *rs, address base, address mask, byte *data, int line);
+
+/* Write all the rows into the ROM images, in order, so that where rows
+   overlap the last one wins.  'slot' gives the image each byte of a
+   row's data is written to, so it has the rowset's 'nbytes' entries;
+   those that are NULL are skipped.  An image more than one byte wide
+   takes as many bytes of the row at once, one per lane, starting at
+   the first slot that names it: so a word of several bytes is written
+   in one pass over the addresses of each row, as are all the ROMs
+   when they share a single image with a lane for each byte.  If
+   'nthreads' is greater than 1 (and thread support is available), the
+   address space is divided into slices that are filled in
+   concurrently.  Returns true if successful, false if memory for the
+   images could not be had.
+ */
+int apply_rows(rowset *rs, image **slot, int abits, int nthreads);
+
+/* Rows being written into ROM images by other threads while the rest
+   of the table is compiled; see start_expander()
+ */
+typedef struct expander expander;
+
+/* Start threads that write rows into the ROM images as they are given
+   to expand_row(), in order, with the same result as apply_rows().
+   'nthreads' threads share the address space as apply_rows() does.
+   Returns NULL if thread support is not available, or the threads or
+   memory for them could not be had, in which case the rows should be
+   applied with apply_rows() as usual.
+ */
+expander *start_expander(image **slot, int nbytes, int abits, int nthreads);
+
+/* Hand a row to the expander threads, copying its data words.  If the
+   threads have fallen behind, this waits for them to catch up.
+ */
+void expand_row(expander *ep, address base, address mask, byte *data);
+
+/* Wait for the expander threads to write all the rows given to them,
+   and release the expander.  Returns true if successful, false if
+   memory for the images could not be had.
+ */
+int finish_expander(expander *ep);
+
+/* An index of a set of rows by their address cubes, so that the rows
+   covering an address can be found without writing them into an image
+ */
+typedef struct rowindex rowindex;
+
+/* Index the rows of a set, which have 'abits' address bits.  The rows
+   must not change while the index is in use.  The memory used grows
+   with the number of rows.  Returns NULL if memory could not be had.
+ */
+rowindex *index_rows(rowset *rs, int abits);
+
+/* Release the memory used by an index */
+void free_index(rowindex *xp);
+
+/* Return the last row that covers address 'addr' (whose data words an
+   image would hold there), or -1 if no row does
+ */
+int last_row(rowindex *xp, address addr);
+
+/* Called by find_rows() with the number of each row it finds */
+typedef void (*row_func)(void *arg, rowset *rs, int ix);
+
+/* Call 'fn' for every row that has some address in common with the
+   cube (base, mask), in no particular order
+ */
+void find_rows(rowindex *xp, address base, address mask, row_func fn,
+               void *arg);
+
+/* Store the numbers of all the rows that have some address in common
+   with the cube (base, mask) in '*rows', in order.  The array is
+   grown with realloc() as need be, and its size kept in '*nalloc'; it
+   may start out NULL, with a size of 0, and must be freed by the
+   caller.  Returns the number of rows found, or -1 if memory could
+   not be had.
+ */
+int list_rows(rowindex *xp, address base, address mask, int **rows,
+              int *nalloc);
+
+/* Called by find_overlaps() for each pair of rows that overlap and
+   have different data words, with the indices of the two rows in the
+   rowset ('first' came earlier in the file than 'second'), and the
+   cube of addresses they have in common
+ */
+typedef void (*overlap_func)(void *arg, rowset *rs, int first, int second,
+                             address base, address mask);
+
+/* Find every pair of rows that write different data to some address,
+   without writing the rows into an image.  The rows are indexed as
+   for index_rows(), so that each row is compared only with those that
+   overlap it.  Returns the number of pairs found, or -1 if memory
+   could not be had.
+ */
+long find_overlaps(rowset *rs, int abits, overlap_func report, void *arg);
+
+#endif /* end _H_TABLE_ */
@@ -10,11 +10,12 @@
 #include "text.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define COMMENT_CHAR '#'
-#define OPTBUF_SIZE 256
+#define MIN_LINE 256 /* initial allocation for read_line() */
 
 /* Remove line-end comments from a zero-terminated string */
 void strip_comment(char *line) {
@@ -64,9 +65,8 @@ int is_prefix(char *str, char *of) {
 
 } /* end is_prefix() */
 
-int parse_option(char *opt, char **name, char **value) {
-  static char namebuf[OPTBUF_SIZE];
-  static char valbuf[OPTBUF_SIZE];
+int parse_option(char *opt, optbuf *buf, char **name, char **value) {
+  char *namebuf = buf->name, *valbuf = buf->value;
   int pos = 0;
 
   if (!is_prefix("--", opt)) return 0;
@@ -82,14 +82,14 @@ int parse_option(char *opt, char **name, char **value) {
   /* Scan name into name buffer, stopping at end of string or
      when an '=' is encountered (denoting a value is next)
    */
-  while (*opt && *opt != '=' && pos < sizeof(namebuf) - 1) {
+  while (*opt && *opt != '=' && pos < sizeof(buf->name) - 1) {
     namebuf[pos++] = *opt;
     ++opt;
   }
   namebuf[pos] = '\0'; /* make sure name is terminated */
 
   /* Send name to output, if possible */
-  if (name) *name = (char *)&namebuf;
+  if (name) *name = namebuf;
 
   /* Is there a value to follow? */
   if (*opt == '\0') return 1; /* no, just return a name */
@@ -102,31 +102,52 @@ int parse_option(char *opt, char **name, char **value) {
      this will be returned as a zero-length string, rather than
      as a NULL
    */
-  while (*opt && pos < sizeof(valbuf) - 1) {
+  while (*opt && pos < sizeof(buf->value) - 1) {
     valbuf[pos++] = *opt;
     ++opt;
   }
   valbuf[pos] = '\0'; /* make sure value is terminated */
 
   /* Send value to output, if possible */
-  if (value) *value = (char *)&valbuf;
+  if (value) *value = valbuf;
 
   return 1;
 
 } /* end parse_option() */
 
-/* Read in a line from the given input source and chop off the newline
-   Returns true if the line was read; false otherwise
+/*
+  The line is read into the buffer with fgets(), a piece at a time,
+  and the buffer doubled each time it fills up before the newline is
+  found; so a line of any length is read in a few passes.
  */
-int read_line(FILE *ifp, char *buf, int len) {
-  int alen;
+int read_line(FILE *ifp, char **buf, size_t *size) {
+  size_t len = 0;
 
-  if (fgets(buf, len, ifp) == NULL) return 0; /* no more lines available */
+  while (1) {
+    int room;
 
-  alen = strlen(buf);
-  if (buf[alen - 1] == '\n') buf[alen - 1] = '\0';
+    if (*size - len < 2) {
+      size_t nsize = (*size == 0) ? MIN_LINE : 2 * *size;
+      char *nbuf = realloc(*buf, nsize);
 
-  return 1;
+      if (nbuf == NULL) return -1;
+
+      *buf = nbuf;
+      *size = nsize;
+    }
+
+    room = (*size - len > INT_MAX) ? INT_MAX : (int)(*size - len);
+    if (fgets(*buf + len, room, ifp) == NULL) break;
+
+    len += strlen(*buf + len);
+    if (len > 0 && (*buf)[len - 1] == '\n') {
+      (*buf)[len - 1] = '\0';
+      return 1;
+    }
+  }
+
+  /* The last line of a file need not end with a newline */
+  return (len > 0);
 
 } /* end read_line() */
 
@@ -206,41 +227,4 @@ void translate(char *str, char from, char to) {
 
 } /* end translate() */
 
-/* Count how many distinct ROM images are specified in the header */
-int count_roms(char *hdr) {
-  int maxrom = -1;
-
-  if (hdr == NULL) return 0;
-
-  /* ROM numbers are specified by single digits */
-  while (*hdr) {
-    if (isdigit((int)*hdr)) {
-      int off = *hdr - '0';
-
-      if (off > maxrom) maxrom = off;
-    }
-
-    ++hdr;
-  }
-
-  return maxrom + 1;
-
-} /* end count_roms() */
-
-/* Count how many address bits are specified in the header */
-int count_addr(char *hdr) {
-  int nbits = 0;
-
-  if (hdr == NULL) return 0;
-
-  while (*hdr) {
-    if (tolower((int)*hdr) == 'a') ++nbits;
-
-    ++hdr;
-  }
-
-  return nbits;
-
-} /* end count_addr() */
-
 /* Here there be dragons */
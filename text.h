@@ -21,25 +21,36 @@ int is_blank(char *line);
 /* Is string 'str' a prefix of string 'of'? */
 int is_prefix(char *str, char *of);
 
+#define OPTBUF_SIZE 256 /* maximum option name or value length */
+
+/* Storage for the name and value of a parsed option */
+typedef struct {
+  char name[OPTBUF_SIZE];
+  char value[OPTBUF_SIZE];
+} optbuf;
+
 /* Parse an option of the form --name[=value].  Yields pointers to the
-   name and value in static storage which is overwritten with each
-   call.  Returns true if the given string is an option, and fills in
-   the name and value fields; false otherwise.
+   name and value, which are stored in 'buf' and overwritten with each
+   call that uses it.  Returns true if the given string is an option,
+   and fills in the name and value fields; false otherwise.
 
    Either 'name' or 'value' may be passed as NULL; if so, the
    parameters will be discarded, and the return value may be used
    simply to determine if the option is valid.
 
    Both option names and value strings are limited to a fixed maximum
-   size (defined as OPTBUF_SIZE in text.c), and will be truncated to
-   that maximum.
+   size (OPTBUF_SIZE), and will be truncated to that maximum.
  */
-int parse_option(char *opt, char **name, char **value);
-
-/* Read in a line from the given input source and chop off the newline
-   Returns true if the line was read; false otherwise
+int parse_option(char *opt, optbuf *buf, char **name, char **value);
+
+/* Read in a line of any length from the given input source and chop
+   off the newline.  The line is stored in '*buf', which is grown with
+   realloc() as need be, and its size kept in '*size'; it may start
+   out NULL, with a size of 0, and must be freed by the caller.
+   Returns 1 if the line was read, 0 if there are no more lines, or -1
+   if memory could not be had.
  */
-int read_line(FILE *ifp, char *buf, int len);
+int read_line(FILE *ifp, char **buf, size_t *size);
 
 /* Allocate a buffer big enough to hold the given string, and copy
    the input string into it; returns a pointer to that buffer. It
@@ -60,10 +71,4 @@ int valid_string(char *str, char *comp);
 /* Translate all occurrences of 'from' to 'to' in the given string */
 void translate(char *str, char from, char to);
 
-/* Count how many distinct ROM images are specified in the header */
-int count_roms(char *hdr);
-
-/* Count how many address bits are specified in the header */
-int count_addr(char *hdr);
-
 #endif /* end _H_TEXT_ */
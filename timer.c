@@ -0,0 +1,45 @@
+/*
+  timer.c
+
+  Measuring elapsed and processor time and memory use, for tt2rom
+  version 2.
+
+  If USE_TIMERS is defined, the elapsed time comes from clock_gettime()
+  and peak memory use from getrusage().  Otherwise, elapsed time comes
+  from time(), which only counts whole seconds, and peak memory use is
+  not known.
+ */
+
+#include "timer.h"
+
+#include <time.h>
+#ifdef USE_TIMERS
+#include <sys/resource.h>
+#endif
+
+double wall_clock(void) {
+#ifdef USE_TIMERS
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  return (double)time(NULL);
+#endif
+
+} /* end wall_clock() */
+
+double cpu_clock(void) { return (double)clock() / CLOCKS_PER_SEC; }
+
+long peak_memory(void) {
+#ifdef USE_TIMERS
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru) == 0) return ru.ru_maxrss;
+#endif
+
+  return -1;
+
+} /* end peak_memory() */
+
+/* Here there be dragons */
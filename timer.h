@@ -0,0 +1,22 @@
+/*
+  timer.h
+
+  Measuring elapsed and processor time and memory use, for tt2rom
+  version 2.
+ */
+
+#ifndef _H_TIMER_
+#define _H_TIMER_
+
+/* Seconds of elapsed (wall clock) time since some fixed moment */
+double wall_clock(void);
+
+/* Seconds of processor time used by the program so far */
+double cpu_clock(void);
+
+/* Most memory the program has held at once, in kilobytes, or -1 if
+   this is not known
+ */
+long peak_memory(void);
+
+#endif /* end _H_TIMER_ */
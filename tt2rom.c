@@ -16,11 +16,15 @@
     used as a configuration line, specifying how the columns of the
     file are to be interpreted.  An 'A' in a column specifies an input
     state bit (i.e., an address bit).  A digit from '0'-'9' specifies
-    which ROM the bits in that column will be assigned to.
+    which ROM the bits in that column will be assigned to.  A group of
+    columns may be given in brackets, as "[id:n]" for 'n' columns (or
+    "[id]" for one), where the id is 'A', a ROM number up to 63, or a
+    name for a ROM, which is numbered after the highest ROM number.
 
     The bits internally sorted out to each ROM, with the MSB on the
     left, LSB on the right.  Values will be left-padded with zeroes if
-    necessary to fill out the word size.  All bits specified on the
+    necessary to fill out the word size, which is 8 bits, or 16, 32 or
+    64 for a ROM given more columns than that.  All bits specified on the
     configuration line MUST be specified on each data line (this is
     different from the old version, which would assume zeroes)
 
@@ -49,69 +53,304 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#include "rom.h"
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "cache.h"
+#include "libtt2rom.h"
+#include "mapfile.h"
+#include "sim.h"
 #include "text.h"
+#include "timer.h"
 
-#define MAXLINE 256          /* maximum input string length (bytes) */
 #define MAXFILENAME 32       /* maximum output filename len (bytes) */
 #define PREFIXLEN 6          /* file name prefix length limit       */
-#define MAXBITS 20           /* maximum number of bits in address   */
-#define NUM_ROMS 10          /* maximum number of ROM images        */
 #define VERSION "2.07"       /* version string              */
 #define FTEMPVAR "FTEMPLATE" /* output template environment */
 
-#define BINARY_FMT 1 /* write binary ROM images             */
-#define TEXT_FMT 2   /* write text format ROM images        */
-#define INTEL_FMT 3  /* write Intel format ROM images       */
+#define BINARY_FMT TT_RAW   /* write binary ROM images       */
+#define TEXT_FMT TT_TEXT    /* write text format ROM images  */
+#define INTEL_FMT TT_INTEL  /* write Intel format ROM images */
+#define SREC_FMT TT_SREC    /* write Motorola S-records      */
+#define TITXT_FMT TT_TITXT  /* write TI-TXT files            */
+#define VMEM_FMT TT_VMEM    /* write Verilog $readmemh files */
+#define CARRAY_FMT TT_CARRAY /* write C array initialisers   */
+#define NUM_FMTS 7
+
+/* Names of the output formats, for --output-fmt, and the extensions
+   given to their files when more than one is written
+ */
+static char *fmt_name[] = {"",    "raw",    "text",     "intel",
+                           "srec", "ti-txt", "readmemh", "c-array"};
+static char *fmt_ext[] = {"", "bin", "lst", "hex", "srec", "txt", "mem", "c"};
+
+#define MAXDIFFS 20 /* mismatched ranges shown per ROM     */
+#define LABELLEN 48 /* room for a ROM's label in messages  */
+#define MIN_VECTORS 64 /* initial allocation for a run's vectors */
+#define MAX_TRACE (LONG_MAX / (long)sizeof(address)) /* steps traced */
+
+/* Phases of processing a file, timed for --stats */
+#define PH_PARSE 0  /* reading and compiling lines      */
+#define PH_EXPAND 1 /* filling in the ROM images        */
+#define PH_OUTPUT 2 /* writing (or verifying) the ROMs  */
+#define NUM_PHASES 3
+
+/* Time taken to write one ROM, and the size of its files in each
+   output format (in the order they were given), for --stats
+ */
+typedef struct {
+  double wall, cpu;
+  double bytes[NUM_FMTS];
+} romstats;
+
+/* Measurements of one input file, for --stats */
+typedef struct {
+  int done;                /* was the file processed?       */
+  int lines, rows, nroms;  /* size of the table             */
+  double written;          /* addresses written by rows     */
+  double distinct;         /* ... counting each one once    */
+  double memory;           /* bytes used by ROM images      */
+  double wall[NUM_PHASES]; /* elapsed time of each phase    */
+  double cpu[NUM_PHASES];  /* processor time of each phase  */
+  romstats *rom;           /* one for each ROM              */
+} filestats;
+
+/* Settings for processing one input file.  Each file is given its
+   own copy, so that several files may be processed at once.
+ */
+typedef struct {
+  int fmt[NUM_FMTS];           /* output formats            */
+  int nfmts;                   /* ... how many of them      */
+  tt_options opt;              /* settings for compiling    */
+  int verify;                  /* check files, don't write  */
+  int check;                   /* look for overlapping rows */
+  int emit;                    /* write compiled tables     */
+  char *query;                 /* addresses to look up      */
+  char *sim;                   /* feedback, if simulating   */
+  char **vecs;                 /* input vector files...     */
+  int nvecs;                   /* ... one for each run      */
+  address start;               /* state the runs start in   */
+  long trace;                  /* steps traced in each run  */
+  int coverage;                /* report addresses visited? */
+  int reach;                   /* find unreachable states?  */
+  int stream;                  /* write without the images  */
+  int map;                     /* map raw files as images   */
+  char mapped[TT_MAXROMS];     /* ROMs whose files are mapped */
+  unsigned long hash;          /* hash of the source table  */
+  char *cache_dir;             /* output cache, or NULL     */
+  centry *cache;               /* entry for this file       */
+  int hits, misses;            /* cache lookups             */
+  char fname[MAXFILENAME + 1]; /* output filename template  */
+  char cname[MAXFILENAME + 1]; /* compiled table file name  */
+  char *ftmpl;                 /* template from environment */
+  FILE *msg;                   /* where messages are sent   */
+  int stats;                   /* measure each file?        */
+  FILE *json;                  /* measurements, or NULL     */
+  filestats *fs;               /* measurements of this file */
+} context;
+
+/* Which output filename template to use */
+#define TEMPLATE(C) ((C)->ftmpl ? (C)->ftmpl : (C)->fname)
+
+/* How many files ROM number 'N' of table 'T' is written to in each
+   format: one for each byte of its word, if they are split
+ */
+#define NUM_LANES(C, T, N) ((C)->opt.split ? tt_word_bytes(T, N) : 1)
+
+/* How many hex digits an address of 'B' bits is printed with, as the
+   text format's listing prints them
+ */
+#define ADDR_DIGITS(B) (((B) > DENSE_BITS) ? 8 : 5)
+
+/* Is the output cache in use?  Only ROM images are cached, in a
+   single format.
+ */
+#define USE_CACHE(C)                                                   \
+  ((C)->cache_dir != NULL && !(C)->verify && !(C)->check && !(C)->emit && \
+   (C)->query == NULL && (C)->sim == NULL && (C)->nfmts == 1 &&         \
+   !(C)->opt.split)
 
-#define OUTPUT_DC '-' /* output "don't care" indicator       */
+/* Set the output formats from a list of their names, separated by
+   commas.  Returns false if a name is not recognized.
+ */
+static int parse_formats(context *ctx, char *list);
 
-int g_fmt = INTEL_FMT;         /* default output format     */
-char g_odcv = '1';             /* output don't care value   */
-char g_fname[MAXFILENAME + 1]; /* output filename template  */
-char *g_ftmpl = g_fname;       /* which template to use     */
+/* The output file name template for the k'th output format, which is
+   built in 'buf' (MAXFILENAME bytes) if need be
+ */
+static char *format_template(context *ctx, int k, char *buf);
 
 /* Test a output template for correct format */
 int template_valid(char *str);
 
 /* Display a help message to the user */
-void do_help(void);
+void do_help(char odcv);
 
-/* Generate output file name template */
-void make_file_template(char *fname, char *tmpl, int tlen);
+/* Generate output file name template, ending with 'tag' */
+void make_file_template(char *fname, char *tag, char *tmpl, int tlen);
 
 /* Process an input stream */
-int process_file(FILE *ifp);
+int process_file(context *ctx, FILE *ifp);
+
+/* Process a compiled table, read from the named file */
+int load_file(context *ctx, char *path);
+
+/* Is the input a compiled table, rather than text? */
+static int is_compiled(FILE *ifp);
+
+/* Compute the hash of the input, which is then rewound */
+static unsigned long hash_file(FILE *ifp);
+
+/* Check, save, or write out the ROM images of a table whose lines
+   have been compiled into rows, returning the exit status
+ */
+static int finish_table(context *ctx, tt_table *tp, double *wall,
+                        double *cpu);
+
+/* Have the ROM images of a table made as mappings of their output
+   files, if that was asked for
+ */
+static void map_roms(context *ctx);
+
+/* Remove the output files that were mapped for a table that could not
+   be written
+ */
+static void remove_mapped(context *ctx);
+
+/* Write a table in compiled form */
+static int write_compiled(context *ctx, tt_table *tp);
+
+/* Look up the addresses given in the query file in an indexed table */
+static int answer_queries(context *ctx, tt_table *tp);
+
+/* Print what the ROMs of an indexed table hold at address 'addr', and
+   the line that gives it, with 'width' digits for the address
+ */
+static void print_lookup(tt_table *tp, address addr, int width);
+
+/* Run the state machine a table describes through the input vector
+   files, as --simulate asks
+ */
+static int simulate(context *ctx, tt_table *tp);
+
+/* Add the time since '*wall' and '*cpu' to phase 'ph' of 'fs', if it
+   is not NULL, and set them to the current time
+ */
+static void next_phase(filestats *fs, int ph, double *wall, double *cpu);
+
+/* Measure the rows and images of a compiled table */
+static int measure_table(filestats *fs, tt_table *tp);
+
+/* Open and process the named input file */
+int run_file(context *ctx, char *path);
+
+/* Look up an input file in the output cache */
+int run_cached(context *ctx, FILE *ifp);
+
+/* Report how well the output cache did */
+void report_cache(context *ctx);
 
-/* Parse an individual data line (assumes preprocessing) */
-int parse_data(char *str, int line, char *config, int abits, byte *accum);
+/* Report the measurements of an input file */
+void report_stats(context *ctx, char *path, int res);
+
+#ifdef USE_THREADS
+/* Process several input files at once, using up to 'nthreads' threads */
+int run_jobs(context *ctx, char **paths, int npaths, int nthreads);
+#endif
 
 /* Shift arguments leftward to remove an old argument */
 int shift_args(int argc, char **argv);
 
-/* Allocate memory for ROM images */
-int alloc_roms(byte ***romp, int nroms, char *config, int abits);
+/* Write ROM images out to files */
+int dump_roms(context *ctx, tt_table *tp);
+
+/* One ROM image to be written to the files that are open for it, one
+   for each output format, or one for each byte lane in each format if
+   its words are split
+ */
+typedef struct {
+  context *ctx;
+  tt_table *tp;
+  int num;    /* ROM number             */
+  int nlanes; /* files in each format   */
+  FILE *ofp[NUM_FMTS][TT_MAXWORD];
+  int ok;     /* were they all written? */
+} romjob;
+
+/* Write one ROM image out to its files, and close them.  Returns
+   true if successful, false if any file could not be written; the
+   result is also stored in the job.
+ */
+static int write_rom(romjob *rj);
 
-/* Release memory used by ROM images */
-void free_roms(byte **romp, int nroms);
+/* The name of the file for byte 'lane' of ROM number 'num', given
+   the template 'tmpl', or of the file for all of it if 'lane' is
+   negative.  A lane's file is named as the ROM's would be, with
+   "_<lane>" put before the extension.
+ */
+static void output_name(char *tmpl, int num, int lane, char *fname);
 
-/* Write ROM images out to files */
-int dump_roms(byte **rom, int nroms, int abits, int fmt);
+/* How messages name ROM number 'num': "#<num>", and the name it was
+   given on the configuration line, if any, in parentheses (cut short
+   if need be).  The label is built in 'buf', which has room for
+   LABELLEN characters.
+ */
+static char *rom_label(tt_table *tp, int num, char *buf);
+
+/* Compare ROM images against existing Intel HEX files */
+int verify_roms(context *ctx, tt_table *tp);
+
+/* What report_overlap() needs to know about the table */
+typedef struct {
+  FILE *msg;
+  int abits;
+} overlap;
+
+/* Report a pair of overlapping rows with different data */
+static void report_overlap(void *arg, rowset *rs, int first, int second,
+                           address base, address mask);
 
 int main(int argc, char *argv[]) {
-  FILE *ifp;
-  int res = 0, ix = 0;
-  char *name, *value;
+  context ctx;
+  optbuf opt;
+  int res = 0, ix = 0, njobs = 1;
+  char *name, *value, *simonly = NULL;
+
+  ctx.fmt[0] = INTEL_FMT;
+  ctx.nfmts = 1;
+  tt_defaults(&ctx.opt);
+  ctx.verify = 0;
+  ctx.check = 0;
+  ctx.emit = 0;
+  ctx.hash = 0;
+  ctx.query = NULL;
+  ctx.sim = NULL;
+  ctx.vecs = NULL;
+  ctx.nvecs = 0;
+  ctx.start = 0;
+  ctx.trace = 0;
+  ctx.coverage = 0;
+  ctx.reach = 0;
+  ctx.stream = 0;
+  ctx.map = 0;
+  ctx.cache_dir = NULL;
+  ctx.cache = NULL;
+  ctx.hits = ctx.misses = 0;
+  ctx.ftmpl = NULL;
+  ctx.msg = stderr;
+  ctx.stats = 0;
+  ctx.json = NULL;
+  ctx.fs = NULL;
 
   /* Parse command line options.  This uses a custom mechanism,
      because the Unix getopt() is not readily available for DOS,
      as far as I can tell
    */
-  while (argc >= 2 && parse_option(argv[1], &name, &value)) {
+  while (argc >= 2 && parse_option(argv[1], &opt, &name, &value)) {
     /* Print help message summarizing command line options */
     if (strcmp(name, "help") == 0) {
-      do_help();
+      do_help(ctx.opt.odcv);
       return 0;
 
       /* Print out a version message and exit the program    */
@@ -141,25 +380,298 @@ int main(int argc, char *argv[]) {
         return 1;
       }
 
-      g_odcv = (bitval ? '1' : '0');
+      ctx.opt.odcv = (bitval ? '1' : '0');
 
       /* Set output format                                   */
     } else if (strcmp(name, "output-fmt") == 0) {
-      if (value == NULL) {
-        fprintf(stderr, "Output format must be 'raw', 'text', or 'intel'\n");
+      if (value == NULL || !parse_formats(&ctx, value)) {
+        fprintf(stderr,
+                "Output format must be 'raw', 'text', 'intel', 'srec', "
+                "'ti-txt', 'readmemh', or 'c-array',\n"
+                "or several of these separated by commas\n");
+        return 1;
+      }
+
+      /* Set the value of locations no row writes to          */
+    } else if (strcmp(name, "fill") == 0) {
+      long fill;
+      char *endp;
+
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Fill value must be specified in hexadecimal\n");
+        return 1;
+      }
+
+      fill = strtol(value, &endp, 16);
+      if (*endp != '\0') {
+        fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+        return 1;
+      } else if (fill < 0 || fill > UCHAR_MAX) {
+        fprintf(stderr, "Fill value out of range: 00-FF expected\n");
+        return 1;
+      }
+
+      ctx.opt.fill = (byte)fill;
+
+      /* Set the data bytes in each Intel HEX or S-record      */
+    } else if (strcmp(name, "record-len") == 0) {
+      long len;
+      char *endp;
+
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Record length must be specified\n");
+        return 1;
+      }
+
+      len = strtol(value, &endp, 10);
+      if (*endp != '\0') {
+        fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+        return 1;
+      } else if (len < 1 || len > MAX_RECLEN) {
+        fprintf(stderr, "Record length out of range: 1-%d expected\n",
+                MAX_RECLEN);
+        return 1;
+      }
+
+      ctx.opt.enc.reclen = (int)len;
+
+      /* Leave runs of a given value out of the output        */
+    } else if (strcmp(name, "skip-blank") == 0) {
+      long blank;
+      char *endp;
+
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Blank value must be specified in hexadecimal\n");
+        return 1;
+      }
+
+      blank = strtol(value, &endp, 16);
+      if (*endp != '\0') {
+        fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+        return 1;
+      } else if (blank < 0 || blank > UCHAR_MAX) {
+        fprintf(stderr, "Blank value out of range: 00-FF expected\n");
         return 1;
       }
 
-      if (strcmp(value, "intel") == 0) {
-        g_fmt = INTEL_FMT;
-      } else if (strcmp(value, "raw") == 0) {
-        g_fmt = BINARY_FMT;
-      } else if (strcmp(value, "text") == 0) {
-        g_fmt = TEXT_FMT;
+      ctx.opt.enc.blank = (int)blank;
+
+      /* Keep all the ROMs of a table in a single image       */
+    } else if (strcmp(name, "interleave") == 0) {
+      ctx.opt.interleave = 1;
+
+      /* Set the order of the bytes of words wider than 8 bits */
+    } else if (strcmp(name, "byte-order") == 0) {
+      if (value != NULL && strcmp(value, "little") == 0) {
+        ctx.opt.enc.big = 0;
+      } else if (value != NULL && strcmp(value, "big") == 0) {
+        ctx.opt.enc.big = 1;
       } else {
-        fprintf(stderr, "Output format must be 'raw', 'text', or 'intel'\n");
+        fprintf(stderr, "Byte order must be 'little' or 'big'\n");
+        return 1;
+      }
+
+      /* Write each byte of a wide word as a ROM of its own    */
+    } else if (strcmp(name, "split-lanes") == 0) {
+      ctx.opt.split = 1;
+
+      /* Route the columns to the pins they are wired to; the
+         groups of several options are joined into one list, read
+         from argv so that long lists are not cut short
+       */
+    } else if (strcmp(name, "pins") == 0) {
+      char *spec = strchr(argv[1], '='), *pins;
+      size_t len = ctx.opt.pins ? strlen(ctx.opt.pins) + 1 : 0;
+
+      if (spec == NULL || spec[1] == '\0') {
+        fprintf(stderr, "Pin assignments must be specified\n");
+        return 1;
+      }
+
+      if ((pins = realloc(ctx.opt.pins, len + strlen(spec))) == NULL) {
+        fprintf(stderr, "Insufficient memory to read options\n");
+        return 1;
+      }
+
+      if (len > 0) pins[len - 1] = ';';
+      strcpy(pins + len, spec + 1);
+      ctx.opt.pins = pins;
+
+      /* Check existing output files instead of writing them  */
+    } else if (strcmp(name, "verify") == 0) {
+      ctx.verify = 1;
+
+      /* Report rows that overwrite each other, writing nothing */
+    } else if (strcmp(name, "check-overlap") == 0) {
+      ctx.check = 1;
+
+      /* Write compiled tables instead of ROM images          */
+    } else if (strcmp(name, "emit-compiled") == 0) {
+      ctx.emit = 1;
+
+      /* Look up addresses instead of writing ROM images       */
+    } else if (strcmp(name, "query") == 0) {
+      /* The option buffer is reused, so keep the original */
+      if (value == NULL || value[0] == '\0')
+        ctx.query = "-";
+      else
+        ctx.query = strchr(argv[1], '=') + 1;
+
+      /* Run the state machine instead of writing ROM images  */
+    } else if (strcmp(name, "simulate") == 0) {
+      ctx.sim = (value == NULL) ? "" : strchr(argv[1], '=') + 1;
+
+      /* Add a file of input vectors, for a run of its own     */
+    } else if (strcmp(name, "vectors") == 0) {
+      char **vecs;
+
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Input vector file must be specified\n");
+        return 1;
+      }
+
+      if ((vecs = realloc(ctx.vecs, (ctx.nvecs + 1) * sizeof(char *))) ==
+          NULL) {
+        fprintf(stderr, "Insufficient memory to read options\n");
+        return 1;
+      }
+
+      vecs[ctx.nvecs++] = strchr(argv[1], '=') + 1;
+      ctx.vecs = vecs;
+      simonly = "vectors";
+
+      /* State bits the runs start with, as an address (hex)   */
+    } else if (strcmp(name, "start") == 0) {
+      char *endp;
+
+      if (value == NULL || !isxdigit((int)value[0])) {
+        fprintf(stderr, "Start state must be given in hexadecimal\n");
+        return 1;
+      }
+
+      ctx.start = strtoul(value, &endp, 16);
+      if (*endp != '\0') {
+        fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+        return 1;
+      }
+      simonly = "start";
+
+      /* Show the first steps of each run                      */
+    } else if (strcmp(name, "trace") == 0) {
+      char *endp;
+
+      ctx.trace = (value == NULL || value[0] == '\0')
+                      ? 100
+                      : strtol(value, &endp, 10);
+      if (value != NULL && value[0] != '\0' &&
+          (*endp != '\0' || ctx.trace < 1)) {
+        fprintf(stderr, "Number of steps to trace must be positive\n");
+        return 1;
+      }
+      if (ctx.trace > MAX_TRACE) ctx.trace = MAX_TRACE;
+      simonly = "trace";
+
+      /* Report the addresses, states and lines the runs reach */
+    } else if (strcmp(name, "coverage") == 0) {
+      ctx.coverage = 1;
+      simonly = "coverage";
+
+      /* Find the states that can never be reached             */
+    } else if (strcmp(name, "reachable") == 0) {
+      ctx.reach = 1;
+      simonly = "reachable";
+
+      /* Reuse output files of tables that have not changed   */
+    } else if (strcmp(name, "cache-dir") == 0) {
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Cache directory must be specified\n");
+        return 1;
+      }
+
+      /* The option buffer is reused, so keep the original */
+      ctx.cache_dir = strchr(argv[1], '=') + 1;
+
+      /* Measure the time and memory taken by each file       */
+    } else if (strcmp(name, "stats") == 0) {
+      ctx.stats = 1;
+
+      if (value != NULL && value[0] != '\0') {
+        if (ctx.json != NULL) fclose(ctx.json);
+
+        if ((ctx.json = fopen(value, "w")) == NULL) {
+          fprintf(stderr, "Unable to open statistics file '%s' for writing\n",
+                  value);
+          return 1;
+        }
+      }
+
+      /* Set the number of input files to process at once     */
+    } else if (strcmp(name, "jobs") == 0) {
+      char *endp;
+
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Number of jobs must be specified\n");
+        return 1;
+      }
+
+      njobs = strtol(value, &endp, 10);
+      if (*endp != '\0') {
+        fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+        return 1;
+      } else if (njobs < 1) {
+        fprintf(stderr, "Number of jobs must be at least 1\n");
+        return 1;
+      }
+#ifndef USE_THREADS
+      if (njobs > 1)
+        fprintf(stderr,
+                "%s: warning: built without thread support, "
+                "files will be processed one at a time\n",
+                argv[0]);
+#endif
+
+      /* Overlap reading, filling in, and writing the ROMs     */
+    } else if (strcmp(name, "pipeline") == 0) {
+      ctx.opt.pipeline = 1;
+#ifndef USE_THREADS
+      fprintf(stderr,
+              "%s: warning: built without thread support, "
+              "--pipeline has no effect\n",
+              argv[0]);
+#endif
+
+      /* Build raw ROM images in their files, with no copy      */
+    } else if (strcmp(name, "map-output") == 0) {
+      ctx.map = 1;
+#ifndef USE_MMAP
+      fprintf(stderr,
+              "%s: warning: built without mmap support, "
+              "--map-output has no effect\n",
+              argv[0]);
+#endif
+
+      /* Write the ROMs a window at a time, in little memory   */
+    } else if (strcmp(name, "stream") == 0) {
+      ctx.stream = 1;
+
+      /* Set the number of threads used to fill in each ROM   */
+    } else if (strcmp(name, "threads") == 0) {
+      char *endp;
+
+      if (value == NULL || value[0] == '\0') {
+        fprintf(stderr, "Number of threads must be specified\n");
+        return 1;
+      }
+
+      ctx.opt.nthreads = strtol(value, &endp, 10);
+      if (*endp != '\0') {
+        fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+        return 1;
+      } else if (ctx.opt.nthreads < 1) {
+        fprintf(stderr, "Number of threads must be at least 1\n");
         return 1;
       }
+
       /* A blank name signals end of option processing       */
     } else if (name[0] == '\0') {
       argc = shift_args(argc, argv);
@@ -179,6 +691,30 @@ int main(int argc, char *argv[]) {
 
   } /* end option parsing */
 
+  /* Runs and their reports need a machine to simulate */
+  if (simonly != NULL && ctx.sim == NULL) {
+    fprintf(stderr, "Option '--%s' needs --simulate\n", simonly);
+    return 1;
+  }
+
+  /* Only ROM images are written in a pipeline or a stream, and a
+     stream never has all of an image to fill in
+   */
+  if (ctx.check || ctx.emit || ctx.query || ctx.sim || ctx.verify)
+    ctx.stream = 0;
+  if (ctx.check || ctx.emit || ctx.query || ctx.stream) ctx.opt.pipeline = 0;
+
+  /* Only raw images, each a ROM of its own, can be files as they are
+     filled in
+   */
+  if (ctx.check || ctx.emit || ctx.query || ctx.sim || ctx.verify ||
+      ctx.stream || ctx.opt.interleave || ctx.opt.split || ctx.nfmts != 1 ||
+      ctx.fmt[0] != BINARY_FMT)
+    ctx.map = 0;
+
+  /* Answers to queries and traces go to the standard output, in order */
+  if (ctx.query || ctx.sim) njobs = 1;
+
   /* Print a welcome banner (so people know what version they have) */
   fprintf(stderr, "This is tt2rom version %s\n\n", VERSION);
 
@@ -192,273 +728,808 @@ int main(int argc, char *argv[]) {
      is provided, or if it is not valid, we'll ignore it and use the
      built in version, to avoid format string attacks */
 
-  snprintf(g_fname, MAXFILENAME, "source%%d.hex"); /* default value */
+  snprintf(ctx.fname, MAXFILENAME, "source%%d.hex"); /* default value */
 
   if ((name = getenv(FTEMPVAR)) != NULL) {
     if (template_valid(name))
-      g_ftmpl = name;
+      ctx.ftmpl = name;
     else
       fprintf(stderr,
               "%s: warning: file name template is invalid, ignoring it\n",
               argv[0]);
   }
 
+#ifdef USE_THREADS
+  if (njobs > 1 && argc > 2) {
+    res = run_jobs(&ctx, argv + 1, argc - 1, njobs);
+    report_cache(&ctx);
+    if (ctx.json != NULL) fclose(ctx.json);
+    return res;
+  }
+#endif
+
   for (ix = 1; ix < argc; ix++) {
-    /* Attempt to open the input file specified */
-    if ((ifp = fopen(argv[ix], "r")) == NULL) {
-      fprintf(stderr, "Unable to open file '%s' for reading\n", argv[1]);
-      return 1;
+    if ((res = run_file(&ctx, argv[ix])) < 0) {
+      res = 1;
+      break;
     }
-
-    /* Set up output file name */
-    if (g_ftmpl == g_fname) make_file_template(argv[ix], g_fname, MAXFILENAME);
-
-    /* Do the deed ... */
-    res = process_file(ifp);
-
-    fclose(ifp);
   }
 
+  report_cache(&ctx);
+  if (ctx.json != NULL) fclose(ctx.json);
+
   return res;
 }
 
 /*
-  The task of this function is to insure that whatever was passed in
-  as a file name template from the environment is actually valid for
-  use as a format string.  If it passes this test, it should be okay
-  and not expose us to any format string vulnerabilities.
+  Returns the result from process_file(), or -1 if the input file
+  could not be opened.
  */
-int template_valid(char *str) {
-  int has_num = 0;
-
-  while (*str) {
-    if (*str == '%') {
-      switch (*(str + 1)) {
-        case 'd':
-          /* A single %d is good, because it means we have a place to put
-             the ROM number.  Having zero or more than one of these is,
-             however, a bad thing, so we'll consider it an error.
-           */
-          if (has_num)
-            return 0;
-          else
-            has_num = 1;
-          break;
+int run_file(context *ctx, char *path) {
+  filestats fs;
+  FILE *ifp;
+  int res;
 
-        case '%':
-          /* Okay, an escaped percent sign.  Just skip over it and continue */
-          break;
+  /* Attempt to open the input file specified */
+  if ((ifp = fopen(path, "r")) == NULL) {
+    fprintf(ctx->msg, "Unable to open file '%s' for reading\n", path);
+    return -1;
+  }
 
-        default:
-          /* Anything else with a percent sign in front of it is definitely
-             Considered Harmful; this string will be rejected in that case,
-             without any further processing.
-           */
-          return 0;
-      }
-      ++str;
-    }
+  /* Set up output file names */
+  if (ctx->ftmpl == NULL)
+    make_file_template(path, "%d.hex", ctx->fname, MAXFILENAME);
+  make_file_template(path, ".ttc", ctx->cname, MAXFILENAME);
 
-    ++str;
+  if (ctx->stats) {
+    memset(&fs, 0, sizeof(fs));
+    ctx->fs = &fs;
   }
 
-  return (has_num == 1); /* all's well */
+  /* Do the deed ... */
+  if (is_compiled(ifp)) {
+    fclose(ifp);
+    res = load_file(ctx, path);
 
-} /* end template_valid() */
+  } else {
+    if (ctx->emit) ctx->hash = hash_file(ifp);
 
-int process_file(FILE *ifp) {
-  char *ibuf, *config = NULL;
-  byte **rom = NULL; /* pointers to ROM images */
-  byte *data = NULL; /* data accumulators      */
-  int line = 0, first = 1, nroms = 0, abits = 0, length = 0, res = 0;
-  int ix;
+    if (USE_CACHE(ctx))
+      res = run_cached(ctx, ifp);
+    else
+      res = process_file(ctx, ifp);
 
-  /* Allocate space to read strings into */
-  if ((ibuf = calloc(MAXLINE + 1, sizeof(char))) == NULL) {
-    fprintf(stderr, "Insufficient memory to process file\n");
-    return 1; /* out of memory */
+    fclose(ifp);
   }
 
-  /* Read strings from the input file */
-  while (read_line(ifp, ibuf, MAXLINE)) {
-    ++line;
-    strip_comment(ibuf);
+  if (ctx->fs != NULL) {
+    if (fs.done) report_stats(ctx, path, res);
 
-    /* Blank lines are skipped in all cases */
-    if (is_blank(ibuf)) continue;
+    free(fs.rom);
+    ctx->fs = NULL;
+  }
 
-    strip_whitespace(ibuf);
+  return res;
 
-    /*
-      When we see the first line, we need to accumulate some other
-      info we're going to need later.  This includes the number of
-      address bits (abits), and the number of ROMs (nroms).  We also
-      need to save a copy of the configuration line for later, since
-      ibuf will be overwritten with each line that is consumed.
+} /* end run_file() */
 
-      We also range-check the values of abits and nroms, and allocate
-      memory for the ROM images we will build during the reading of
-      the rest of the file.  We save the length of the configuration
-      line (length) so that we can syntax check subsequent lines in
-      an efficent manner.
-     */
-    if (first) {
-      /* Check structural validity of configuration line */
-      if (!valid_string(ibuf, "0123456789Aa")) {
-        fprintf(stderr, "Line %d: invalid character in configuration\n", line);
-        res = 1;
-        goto CLEANUP;
-      }
-
-      /* Count number of ROM cells and address (state) bits */
-      nroms = count_roms(ibuf);
-      abits = count_addr(ibuf);
-
-      /* Complain if we didn't get at least 1 ROM, or if we got too many */
-      if (nroms < 1) {
-        fprintf(stderr, "Line %d: must specify at least 1 ROM number\n", line);
-        res = 2;
-        goto CLEANUP;
-      } else if (nroms > NUM_ROMS) {
-        fprintf(stderr, "Line %d: cannot specify more than %d ROMs\n", line,
-                NUM_ROMS);
-        res = 2;
-        goto CLEANUP;
-      }
-
-      /* Complain if we got no address bits, or more than MAXBITS */
-      if (abits < 1 || abits > MAXBITS) {
-        fprintf(stderr, "Line %d: must have between 1-%d state bits\n", line,
-                MAXBITS);
-        res = 3;
-        goto CLEANUP;
-      }
-
-      /* Okay, the config is alright, save it for later ... */
-      if ((config = copy_string(ibuf)) == NULL) {
-        fprintf(stderr, "Insufficient memory to process file\n");
-        res = 1;
-        goto CLEANUP;
-      }
-
-      /* Hang onto the length, we'll need it later */
-      length = strlen(config);
-
-      /* Allocate space for the ROMs and their accumulators */
-      if (!alloc_roms(&rom, nroms, config, abits)) {
-        fprintf(stderr, "Insufficient memory to process file\n");
-        res = 1;
-        goto CLEANUP;
-      }
-      if ((data = calloc(nroms, sizeof(byte))) == NULL) {
-        fprintf(stderr, "Insufficient memory to process file\n");
-        res = 1;
-        goto CLEANUP;
-      }
-
-      first = 0;
-      continue;
-    } /* end if(first) */
-
-    /* Translate output "don't care" values to regular bits */
-    translate(ibuf, OUTPUT_DC, g_odcv);
-
-    /* Anything bad left in the string? */
-    if (!valid_string(ibuf, "01Xx")) {
-      fprintf(stderr, "Line %d: invalid character in data\n", line);
-      res = 1;
-      goto CLEANUP;
-    }
+/*
+  The settings that go into the cache key are those that change what
+  is written: the program version and output revision (TT_OUTREV),
+  the output format and record layout, the output don't-care and fill
+  values, the pins the columns are wired to, and the output file name
+  template.  On a miss, the file is processed as usual, and dump_roms()
+  stores what it writes.
+ */
+int run_cached(context *ctx, FILE *ifp) {
+  centry ce;
+  char *settings;
+  int res, nfiles;
+
+  settings = malloc(strlen(TEMPLATE(ctx)) + sizeof(VERSION) + 128 +
+                    (ctx->opt.pins ? strlen(ctx->opt.pins) : 0));
+  if (settings == NULL) {
+    fprintf(ctx->msg, "Insufficient memory to process file\n");
+    return 1;
+  }
 
-    /* Make sure we got enough fields to satisfy the template */
-    if (strlen(ibuf) != length) {
-      fprintf(stderr, "Line %d: wrong number of fields (wanted %u, got %u)\n",
-              line, (unsigned)length, (unsigned)strlen(ibuf));
-      res = 4;
-      goto CLEANUP;
-    }
+  sprintf(settings,
+          "tt2rom %s rev %d\n"
+          "fmt=%d odcv=%c fill=%02X reclen=%d blank=%d big=%d\n"
+          "pins=%s\n%s\n",
+          VERSION, TT_OUTREV, ctx->fmt[0], ctx->opt.odcv, ctx->opt.fill,
+          ctx->opt.enc.reclen, ctx->opt.enc.blank, ctx->opt.enc.big,
+          ctx->opt.pins ? ctx->opt.pins : "", TEMPLATE(ctx));
 
-    /* Grab all the data out of the line, escaping on error */
-    if (!parse_data(ibuf, line, config, abits, data)) {
-      res = 5;
-      goto CLEANUP;
-    }
+  if (!cache_open(&ce, ctx->cache_dir, settings, ifp)) {
+    fprintf(ctx->msg, "Insufficient memory to process file\n");
+    res = 1;
 
-    /* Write the data into the ROM images.  We know which ROMs
-       to use by checking the pointers in the ROM image array,
-       and the accumulator is already set to go
-     */
-    for (ix = 0; ix < nroms; ix++) {
-      if (rom[ix]) {
-        write_range(rom[ix], ibuf, abits, data[ix]);
-      }
-    }
+  } else if ((nfiles = cache_fetch(&ce, TEMPLATE(ctx))) > 0) {
+    fprintf(ctx->msg, "%d ROM images copied from cache '%s'\n", nfiles,
+            ctx->cache_dir);
+    ++ctx->hits;
+    res = 0;
 
-    /* Clear out accumulators for the next round */
-    memset(data, 0, nroms);
+  } else {
+    ++ctx->misses;
+    ctx->cache = &ce;
+    res = process_file(ctx, ifp);
+    ctx->cache = NULL;
+  }
 
-  } /* end while(read_line(...)) */
+  cache_close(&ce);
+  free(settings);
 
-  /* If we didn't get a first line at all, the file was logically
-     empty (i.e., not even a configuration!) */
-  if (first) {
-    fprintf(stderr, "No configuration line was found\n");
-    res = 7;
+  return res;
 
-  } else {
-    /* Having accumulated all the data into the ROM images, we now
-       will dump them out into the appropriate files */
-    if (!dump_roms(rom, nroms, abits, g_fmt)) res = 6;
-  }
+} /* end run_cached() */
 
-CLEANUP:
-  free(ibuf);
+void report_cache(context *ctx) {
+  if (USE_CACHE(ctx))
+    fprintf(stderr, "Output cache: %d hits, %d misses\n", ctx->hits,
+            ctx->misses);
 
-  if (config) free(config);
+} /* end report_cache() */
 
-  if (rom) {
-    free_roms(rom, nroms);
-    free(rom);
-  }
+static void next_phase(filestats *fs, int ph, double *wall, double *cpu) {
+  double now_wall = wall_clock(), now_cpu = cpu_clock();
 
-  if (data) free(data);
+  if (fs != NULL) {
+    fs->wall[ph] += now_wall - *wall;
+    fs->cpu[ph] += now_cpu - *cpu;
+  }
 
-  return res;
+  *wall = now_wall;
+  *cpu = now_cpu;
 
-} /* end process_file() */
+} /* end next_phase() */
 
-/*
-  We know, a priori, that the strings passed in to this function
-  consist only of valid characters (we checked in process_file() by
-  calling the valid_string() function).  Thus, we can just grobble
-  through the string assigning bits to the accumulators.
+/* If memory runs short, 'fs->rom' is left NULL, and only the phase
+   times are reported
  */
-int parse_data(char *str, int line, char *config, int abits, byte *accum) {
-  int pos = abits;
+static int measure_table(filestats *fs, tt_table *tp) {
+  fs->nroms = tp->nroms;
+  fs->memory = tt_image_size(tp);
 
-  while (isdigit((int)str[pos])) {
-    int bit = str[pos] - '0';     /* get bit value  */
-    int rnum = config[pos] - '0'; /* get ROM number */
+  if (!tt_coverage(tp, &fs->written, &fs->distinct)) return 0;
 
-    /* Write this bit into the accumulator for its ROM */
-    accum[rnum] = (accum[rnum] << 1) | bit;
-    ++pos;
-  }
+  return (fs->rom = calloc(tp->nroms, sizeof(romstats))) != NULL;
 
-  if (str[pos] != '\0') {
-    fprintf(stderr, "Line %d: illegal don't-care bit in data\n", line);
-    return 0;
+} /* end measure_table() */
+
+/* Write a string to a JSON file, quoted and escaped */
+static void json_string(FILE *ofp, char *str) {
+  fputc('"', ofp);
+
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      fprintf(ofp, "\\%c", *str);
+    else if ((unsigned char)*str < ' ')
+      fprintf(ofp, "\\u%04X", (unsigned char)*str);
+    else
+      fputc(*str, ofp);
   }
 
-  return 1;
+  fputc('"', ofp);
 
-} /* end parse_data() */
+} /* end json_string() */
 
-int shift_args(int argc, char **argv) {
-  int pos = 2;
+/* Were any of a ROM's files written? */
+static int rom_written(context *ctx, romstats *rs) {
+  int k;
 
-  while (pos < argc) {
-    argv[pos - 1] = argv[pos];
+  for (k = 0; k < ctx->nfmts; k++)
+    if (rs->bytes[k] > 0) return 1;
+
+  return 0;
+
+} /* end rom_written() */
+
+/*
+  A summary is written to the message stream, and if a statistics
+  file was given, a JSON object on a single line is written there.
+ */
+void report_stats(context *ctx, char *path, int res) {
+  static char *phase_name[NUM_PHASES] = {"parse", "expand", "output"};
+  filestats *fs = ctx->fs;
+  long peak = peak_memory();
+  char *sep;
+  int ix, k;
+
+  fprintf(ctx->msg, "Statistics for '%s':\n", path);
+  fprintf(ctx->msg, "  %d lines, %d rows\n", fs->lines, fs->rows);
+  if (fs->rom != NULL) {
+    fprintf(ctx->msg, "  %.0f addresses written, %.0f over earlier rows\n",
+            fs->written, fs->written - fs->distinct);
+    fprintf(ctx->msg, "  %.0f bytes of ROM images\n", fs->memory);
+  }
+  if (peak >= 0) fprintf(ctx->msg, "  %ld KB peak memory\n", peak);
+
+  for (ix = 0; ix < NUM_PHASES; ix++)
+    fprintf(ctx->msg, "  %-8s %10.6fs wall %10.6fs cpu\n", phase_name[ix],
+            fs->wall[ix], fs->cpu[ix]);
+
+  for (ix = 0; fs->rom != NULL && ix < fs->nroms; ix++) {
+    if (!rom_written(ctx, fs->rom + ix)) continue;
+
+    fprintf(ctx->msg, "  ROM #%-3d %10.6fs wall %10.6fs cpu ", ix,
+            fs->rom[ix].wall, fs->rom[ix].cpu);
+    for (k = 0; k < ctx->nfmts; k++)
+      fprintf(ctx->msg, "%s %.0f bytes %s", k ? "," : "", fs->rom[ix].bytes[k],
+              fmt_name[ctx->fmt[k]]);
+    fprintf(ctx->msg, "\n");
+  }
+
+  if (ctx->json == NULL) return;
+
+  fprintf(ctx->json, "{\"file\": ");
+  json_string(ctx->json, path);
+  fprintf(ctx->json, ", \"status\": %d, \"lines\": %d, \"rows\": %d", res,
+          fs->lines, fs->rows);
+  fprintf(ctx->json, ", \"addresses\": %.0f, \"overwritten\": %.0f",
+          fs->written, fs->written - fs->distinct);
+  fprintf(ctx->json, ", \"image_bytes\": %.0f, \"peak_kb\": %ld", fs->memory,
+          peak);
+
+  fprintf(ctx->json, ", \"phases\": {");
+  for (ix = 0; ix < NUM_PHASES; ix++)
+    fprintf(ctx->json, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}",
+            ix ? ", " : "", phase_name[ix], fs->wall[ix], fs->cpu[ix]);
+
+  fprintf(ctx->json, "}, \"format\": \"");
+  if (ctx->check || ctx->query || ctx->sim || ctx->emit || ctx->verify) {
+    fprintf(ctx->json, "%s",
+            ctx->check   ? "check"
+            : ctx->query ? "query"
+            : ctx->sim   ? "simulate"
+            : ctx->emit  ? "compiled"
+                         : "verify");
+  } else {
+    for (ix = 0; ix < ctx->nfmts; ix++)
+      fprintf(ctx->json, "%s%s", ix ? "," : "", fmt_name[ctx->fmt[ix]]);
+  }
+  fprintf(ctx->json, "\", \"roms\": [");
+  for (ix = 0, sep = ""; fs->rom != NULL && ix < fs->nroms; ix++) {
+    if (!rom_written(ctx, fs->rom + ix)) continue;
+
+    fprintf(ctx->json, "%s{\"rom\": %d, \"bytes\": {", sep, ix);
+    for (k = 0; k < ctx->nfmts; k++)
+      fprintf(ctx->json, "%s\"%s\": %.0f", k ? ", " : "",
+              fmt_name[ctx->fmt[k]], fs->rom[ix].bytes[k]);
+    fprintf(ctx->json, "}, \"wall\": %.6f, \"cpu\": %.6f}",
+            fs->rom[ix].wall, fs->rom[ix].cpu);
+    sep = ", ";
+  }
+  fprintf(ctx->json, "]}\n");
+
+} /* end report_stats() */
+
+#ifdef USE_THREADS
+
+/* One input file to be processed by run_jobs() */
+typedef struct {
+  char *path;  /* input file name           */
+  context ctx; /* settings and message log  */
+  int res;     /* result from run_file()    */
+  int done;    /* has this job finished?    */
+  int taken;   /* has a worker taken it?    */
+  int chain;   /* next job with its outputs */
+  char out[MAXFILENAME]; /* output template */
+} job;
+
+/* State shared by the worker threads of run_jobs() */
+typedef struct {
+  job *jobs;
+  FILE *json; /* where statistics are collected */
+  int njobs;
+  int next;  /* next job to be started          */
+  int shown; /* jobs whose messages are printed */
+  pthread_mutex_t lock;
+} pool;
+
+/* Copy a temporary file to 'ofp', and close it */
+static void copy_temp(FILE *tfp, FILE *ofp) {
+  char buf[BUFSIZ];
+  size_t len;
+
+  rewind(tfp);
+  while ((len = fread(buf, 1, sizeof(buf), tfp)) > 0) fwrite(buf, 1, len, ofp);
+
+  fclose(tfp);
+
+} /* end copy_temp() */
+
+/* Copy the messages saved for a job to the standard error, and its
+   statistics to the statistics file
+ */
+static void show_messages(job *jp, FILE *json) {
+  if (jp->ctx.msg != stderr) {
+    copy_temp(jp->ctx.msg, stderr);
+    jp->ctx.msg = stderr;
+  }
+
+  if (jp->ctx.json != json) {
+    copy_temp(jp->ctx.json, json);
+    jp->ctx.json = json;
+  }
+
+} /* end show_messages() */
+
+/* Each worker takes the next unstarted job until none remain, along
+   with the later jobs that write the same output files, which it
+   processes in order after it.  When a job finishes, the messages of
+   all the jobs finished so far are printed in the order the files were
+   given, so the output does not depend on how the threads happened to
+   be scheduled.
+ */
+static void *worker(void *arg) {
+  pool *pp = arg;
+
+  while (1) {
+    job *jp;
+    int ix;
+
+    pthread_mutex_lock(&pp->lock);
+    while (pp->next < pp->njobs && pp->jobs[pp->next].taken) ++pp->next;
+    if (pp->next >= pp->njobs) {
+      pthread_mutex_unlock(&pp->lock);
+      break;
+    }
+    for (ix = pp->next; ix >= 0; ix = pp->jobs[ix].chain)
+      pp->jobs[ix].taken = 1;
+    jp = pp->jobs + pp->next++;
+    pthread_mutex_unlock(&pp->lock);
+
+    while (1) {
+      jp->res = run_file(&jp->ctx, jp->path);
+
+      pthread_mutex_lock(&pp->lock);
+      jp->done = 1;
+      while (pp->shown < pp->njobs && pp->jobs[pp->shown].done)
+        show_messages(pp->jobs + pp->shown++, pp->json);
+      pthread_mutex_unlock(&pp->lock);
+
+      if (jp->chain < 0) break;
+      jp = pp->jobs + jp->chain;
+    }
+  }
+
+  return NULL;
+
+} /* end worker() */
+
+/*
+  The results are the same as processing the files one at a time:
+  messages come out in order, the exit status is that of the last
+  file, and if an input file cannot be opened, the files after it are
+  not processed.  Each job's messages are held in a temporary file
+  until it is their turn to be printed.  Files whose outputs would have
+  the same names (because their names share a prefix, or FTEMPLATE
+  gives them all) are processed one after another, so the last one
+  given wins, as it would without --jobs.
+ */
+int run_jobs(context *ctx, char **paths, int npaths, int nthreads) {
+  pthread_t *tids;
+  pool pl;
+  FILE *ifp;
+  int ix, jx, nstarted = 0, res = 0;
+
+  /* Find out how many of the inputs can be processed */
+  for (pl.njobs = 0; pl.njobs < npaths; pl.njobs++) {
+    if ((ifp = fopen(paths[pl.njobs], "r")) == NULL) break;
+
+    fclose(ifp);
+  }
+
+  if ((pl.jobs = calloc(pl.njobs + 1, sizeof(job))) == NULL ||
+      (tids = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+    fprintf(stderr, "Insufficient memory to process files\n");
+    free(pl.jobs);
+    return 1;
+  }
+
+  for (ix = 0; ix < pl.njobs; ix++) {
+    pl.jobs[ix].path = paths[ix];
+    pl.jobs[ix].ctx = *ctx;
+    if ((pl.jobs[ix].ctx.msg = tmpfile()) == NULL) pl.jobs[ix].ctx.msg = stderr;
+    if (ctx->json && (pl.jobs[ix].ctx.json = tmpfile()) == NULL)
+      pl.jobs[ix].ctx.json = ctx->json;
+
+    /* Chain each job to the last one before it with the same outputs */
+    if (ctx->ftmpl)
+      snprintf(pl.jobs[ix].out, MAXFILENAME, "%s", ctx->ftmpl);
+    else
+      make_file_template(paths[ix], "%d.hex", pl.jobs[ix].out, MAXFILENAME);
+    pl.jobs[ix].chain = -1;
+
+    for (jx = ix - 1; jx >= 0; jx--) {
+      if (strcmp(pl.jobs[jx].out, pl.jobs[ix].out) == 0) {
+        pl.jobs[jx].chain = ix;
+        break;
+      }
+    }
+  }
+  pl.json = ctx->json;
+  pl.next = pl.shown = 0;
+  pthread_mutex_init(&pl.lock, NULL);
+
+  if (nthreads > pl.njobs) nthreads = pl.njobs;
+
+  for (ix = 0; ix < nthreads; ix++) {
+    if (pthread_create(tids + ix, NULL, worker, &pl) != 0) break;
+    ++nstarted;
+  }
+
+  /* If no threads could be started at all, do the work here */
+  if (nstarted == 0) worker(&pl);
+
+  for (ix = 0; ix < nstarted; ix++) pthread_join(tids[ix], NULL);
+
+  pthread_mutex_destroy(&pl.lock);
+
+  if (pl.njobs > 0) res = pl.jobs[pl.njobs - 1].res;
+
+  for (ix = 0; ix < pl.njobs; ix++) {
+    ctx->hits += pl.jobs[ix].ctx.hits;
+    ctx->misses += pl.jobs[ix].ctx.misses;
+  }
+
+  /* Report the input file that stopped us, if any */
+  if (pl.njobs < npaths) {
+    fprintf(stderr, "Unable to open file '%s' for reading\n", paths[pl.njobs]);
+    res = 1;
+  }
+
+  free(pl.jobs);
+  free(tids);
+
+  return res;
+
+} /* end run_jobs() */
+
+#endif /* USE_THREADS */
+
+/*
+  The task of this function is to insure that whatever was passed in
+  as a file name template from the environment is actually valid for
+  use as a format string.  If it passes this test, it should be okay
+  and not expose us to any format string vulnerabilities.
+ */
+int template_valid(char *str) {
+  int has_num = 0;
+
+  while (*str) {
+    if (*str == '%') {
+      switch (*(str + 1)) {
+        case 'd':
+          /* A single %d is good, because it means we have a place to put
+             the ROM number.  Having zero or more than one of these is,
+             however, a bad thing, so we'll consider it an error.
+           */
+          if (has_num)
+            return 0;
+          else
+            has_num = 1;
+          break;
+
+        case '%':
+          /* Okay, an escaped percent sign.  Just skip over it and continue */
+          break;
+
+        default:
+          /* Anything else with a percent sign in front of it is definitely
+             Considered Harmful; this string will be rejected in that case,
+             without any further processing.
+           */
+          return 0;
+      }
+      ++str;
+    }
+
+    ++str;
+  }
+
+  return (has_num == 1); /* all's well */
+
+} /* end template_valid() */
+
+/*
+  The lines of the file are handed to the compiler one at a time, as
+  they are read.
+ */
+int process_file(context *ctx, FILE *ifp) {
+  char *ibuf = NULL;
+  size_t isize = 0;
+  filestats *fs = ctx->fs;
+  double wall = 0, cpu = 0;
+  tt_table tab;
+  int res, got;
+
+  map_roms(ctx);
+  tt_begin(&tab, &ctx->opt);
+
+  if (fs) next_phase(NULL, 0, &wall, &cpu);
+
+  /* Read strings from the input file, stopping at the first error;
+     the buffer grows to hold the longest line
+   */
+  while ((got = read_line(ifp, &ibuf, &isize)) > 0)
+    if (tt_add_line(&tab, ibuf) != TT_OK) break;
+
+  if (fs) next_phase(fs, PH_PARSE, &wall, &cpu);
+
+  if (got < 0) {
+    tt_free(&tab);
+    free(ibuf);
+    remove_mapped(ctx);
+    fprintf(ctx->msg, "Insufficient memory to process file\n");
+    return 1; /* out of memory */
+  }
+
+  res = finish_table(ctx, &tab, &wall, &cpu);
+
+  tt_free(&tab);
+  free(ibuf);
+
+  if (res != 0) remove_mapped(ctx);
+
+  return res;
+
+} /* end process_file() */
+
+/*
+  The rows are copied out of the file as it is loaded, so the file is
+  released before the table is processed.  Loading counts as the
+  parse phase.
+ */
+int load_file(context *ctx, char *path) {
+  filestats *fs = ctx->fs;
+  double wall = 0, cpu = 0;
+  mapping mf;
+  tt_table tab;
+  int res;
+
+  if (!map_file(path, &mf)) {
+    fprintf(ctx->msg, "Unable to read compiled table '%s'\n", path);
+    return 1;
+  }
+
+  if (fs) next_phase(NULL, 0, &wall, &cpu);
+
+  map_roms(ctx);
+  tt_load(&tab, &ctx->opt, mf.data, mf.len, &ctx->hash);
+  unmap_file(&mf);
+
+  if (fs) next_phase(fs, PH_PARSE, &wall, &cpu);
+
+  if (tab.err == TT_OK) {
+    fprintf(ctx->msg, "Loaded compiled table of %d rows (source hash %08lX)\n",
+            tab.rows.nrows, ctx->hash);
+
+    if (tab.opt.odcv != ctx->opt.odcv)
+      fprintf(ctx->msg,
+              "Warning: output don't-care bits were compiled as %c, "
+              "not %c\n",
+              tab.opt.odcv, ctx->opt.odcv);
+  }
+
+  res = finish_table(ctx, &tab, &wall, &cpu);
+
+  tt_free(&tab);
+
+  if (res != 0) remove_mapped(ctx);
+
+  return res;
+
+} /* end load_file() */
+
+static int is_compiled(FILE *ifp) {
+  char magic[4];
+  int res;
+
+  res = fread(magic, 1, 4, ifp) == 4 && memcmp(magic, TT_MAGIC, 4) == 0;
+  rewind(ifp);
+
+  return res;
+
+} /* end is_compiled() */
+
+static unsigned long hash_file(FILE *ifp) {
+  unsigned long hash = TT_HASHINIT;
+  char buf[BUFSIZ];
+  size_t len;
+
+  while ((len = fread(buf, 1, sizeof(buf), ifp)) > 0)
+    hash = tt_hash(hash, buf, len);
+
+  rewind(ifp);
+
+  return hash;
+
+} /* end hash_file() */
+
+/*
+  The exit status depends on the error found:
+
+    1 - bad character, out of memory,     5 - don't-care in output
+        or damaged compiled table         6 - output could not be written
+    2 - too few or too many ROMs, or      7 - no configuration line
+        too many bits for one
+    3 - too few or too many address bits  8 - verification failed
+    4 - wrong number of fields            9 - rows overlap
+ */
+static int finish_table(context *ctx, tt_table *tp, double *wall,
+                        double *cpu) {
+  static int status[] = {0, 1, 1, 2, 2, 3, 1, 4, 5, 7, 1, 2, 2};
+  char msg[TT_MSGLEN];
+  filestats *fs = ctx->fs;
+  overlap ov;
+  long count;
+  int res = 0;
+
+  /* When checking for overlaps, the ROM images are never filled in */
+  if (ctx->check) {
+    ov.msg = ctx->msg;
+    ov.abits = tp->abits;
+
+    if (tt_check(tp, report_overlap, &ov, &count) != TT_OK) {
+      tt_message(tp, msg);
+      fprintf(ctx->msg, "%s\n", msg);
+      res = status[tp->err];
+
+    } else if (count > 0) {
+      fprintf(ctx->msg, "%ld pairs of overlapping rows with different data\n",
+              count);
+      res = 9;
+
+    } else {
+      fprintf(ctx->msg, "No overlapping rows with different data\n");
+    }
+
+    if (fs) next_phase(fs, PH_EXPAND, wall, cpu);
+
+    /* Nor are they when looking up addresses */
+  } else if (ctx->query) {
+    if (tt_index(tp) != TT_OK) {
+      tt_message(tp, msg);
+      fprintf(ctx->msg, "%s\n", msg);
+      res = status[tp->err];
+    }
+
+    if (fs) next_phase(fs, PH_EXPAND, wall, cpu);
+
+    if (res == 0 && !answer_queries(ctx, tp)) res = 1;
+
+    if (fs) next_phase(fs, PH_OUTPUT, wall, cpu);
+
+    /* The state machine is run from the ROM images */
+  } else if (ctx->sim) {
+    if (tt_end(tp) != TT_OK) {
+      tt_message(tp, msg);
+      fprintf(ctx->msg, "%s\n", msg);
+      res = status[tp->err];
+    }
+
+    if (fs) next_phase(fs, PH_EXPAND, wall, cpu);
+
+    if (res == 0 && !simulate(ctx, tp)) res = 1;
+
+    if (fs) next_phase(fs, PH_OUTPUT, wall, cpu);
+
+    /* Nor when saving the rows in compiled form */
+  } else if (ctx->emit) {
+    if (!write_compiled(ctx, tp)) {
+      if (tp->err != TT_OK) {
+        tt_message(tp, msg);
+        fprintf(ctx->msg, "%s\n", msg);
+        res = status[tp->err];
+      } else {
+        res = 6;
+      }
+    }
+
+    if (fs) next_phase(fs, PH_OUTPUT, wall, cpu);
+
+    /* When streaming, the rows are only indexed, and the images are
+       filled in a window at a time as they are written
+     */
+  } else if (ctx->stream) {
+    if (tt_index(tp) != TT_OK) {
+      tt_message(tp, msg);
+      fprintf(ctx->msg, "%s\n", msg);
+      res = status[tp->err];
+
+    } else {
+      if (fs) next_phase(fs, PH_EXPAND, wall, cpu);
+
+      if (!dump_roms(ctx, tp)) res = 6;
+
+      if (fs) next_phase(fs, PH_OUTPUT, wall, cpu);
+    }
+
+    /* Write the data into the ROM images, and if all went well, dump
+       them out into the appropriate files (or check them)
+     */
+  } else if (tt_end(tp) != TT_OK) {
+    tt_message(tp, msg);
+    fprintf(ctx->msg, "%s\n", msg);
+    res = status[tp->err];
+
+  } else {
+    /* Measuring the table is not part of any phase */
+    if (fs) {
+      next_phase(fs, PH_EXPAND, wall, cpu);
+      if (!measure_table(fs, tp))
+        fprintf(ctx->msg, "Insufficient memory to measure table\n");
+      next_phase(NULL, 0, wall, cpu);
+    }
+
+    if (ctx->verify) {
+      if (!verify_roms(ctx, tp)) res = 8;
+
+    } else if (!dump_roms(ctx, tp)) {
+      res = 6;
+    }
+
+    if (fs) next_phase(fs, PH_OUTPUT, wall, cpu);
+  }
+
+  if (fs) {
+    fs->done = 1;
+    fs->lines = tp->line;
+    fs->rows = tp->rows.nrows;
+  }
+
+  return res;
+
+} /* end finish_table() */
+
+/* Pass output of tt_save(), tt_encode() or tt_stream() to a file */
+static int file_put(void *arg, char *buf, size_t len) {
+  return fwrite(buf, 1, len, (FILE *)arg) == len;
+
+} /* end file_put() */
+
+/*
+  Returns false if the table has an error (which tt_save() reports),
+  or the file could not be written.
+ */
+static int write_compiled(context *ctx, tt_table *tp) {
+  FILE *ofp;
+  int ok;
+
+  if (tp->err != TT_OK) return 0;
+
+  if ((ofp = fopen(ctx->cname, "wb")) == NULL) {
+    fprintf(ctx->msg, "Unable to open output file '%s' for writing\n",
+            ctx->cname);
+    return 0;
+  }
+
+  fprintf(ctx->msg, "Writing compiled table to file '%s'\n", ctx->cname);
+
+  ok = tt_save(tp, ctx->hash, file_put, ofp);
+  if (fclose(ofp) != 0) ok = 0;
+
+  /* Leave no partial file behind */
+  if (!ok) {
+    remove(ctx->cname);
+
+    if (tp->err == TT_OK)
+      fprintf(ctx->msg, "Unable to write compiled table to '%s'\n",
+              ctx->cname);
+  }
+
+  return ok;
+
+} /* end write_compiled() */
+
+int shift_args(int argc, char **argv) {
+  int pos = 2;
+
+  while (pos < argc) {
+    argv[pos - 1] = argv[pos];
     pos++;
   }
 
@@ -466,7 +1537,7 @@ int shift_args(int argc, char **argv) {
 
 } /* end shift_args() */
 
-void do_help(void) {
+void do_help(char odcv) {
   fprintf(stderr,
           "Help for tt2rom version %s:\n\n"
 
@@ -487,16 +1558,133 @@ void do_help(void) {
           "                  in the output to X, where X is 0 or 1\n"
           "                  The current default is %c\n"
           " --output-fmt=X - set output format to X, where X is one\n"
-          "                  of 'raw', 'text', or 'intel'.\n\n"
+          "                  of 'raw', 'text', or 'intel'.\n",
+
+          odcv);
+
+  fprintf(stderr,
+          "                  Also 'srec', 'ti-txt', 'readmemh', or\n"
+          "                  'c-array'; give several, separated by\n"
+          "                  commas, to write each ROM in all of them\n");
+
+  fprintf(stderr,
+          " --fill=HH      - set the value of locations not given by\n"
+          "                  any row to HH (hex); the default is 00\n"
+          " --record-len=N - put N data bytes (1-255) in each Intel\n"
+          "                  HEX or S-record; the default is 16\n"
+          " --skip-blank=HH - leave runs of HH (hex) out of files\n"
+          "                  that give addresses\n"
+          " --interleave   - build all ROMs of a table in one image\n"
+          " --jobs=N       - process up to N input files at once\n"
+          " --threads=N    - use N threads to fill in each ROM image\n");
+
+  fprintf(stderr,
+          " --byte-order=X - write words wider than 8 bits with the\n"
+          "                  least ('little', the default) or most\n"
+          "                  ('big') significant byte first\n"
+          " --split-lanes  - write each byte of such words to a file\n"
+          "                  of its own, as for even/odd ROM pairs\n"
+          " --pins=ID:P,.. - wire the columns of the address (ID 'A')\n"
+          "                  or a ROM to pins P, .. of it, left to\n"
+          "                  right; groups are separated by ';'\n");
+
+  fprintf(stderr,
+          " --pipeline     - fill in the ROM images while reading the\n"
+          "                  table, and write all the ROMs at once\n"
+          " --map-output   - with raw output, build each ROM image\n"
+          "                  in its file, mapped into memory\n"
+          " --stream       - write the ROMs a window at a time, so\n"
+          "                  whole images are never held in memory\n"
+          " --verify       - compare the tables against existing\n"
+          "                  Intel HEX files instead of writing them\n");
 
-          "Report bugs to <admin@thayer.dartmouth.edu>\n\n",
+  fprintf(stderr,
+          " --cache-dir=D  - keep output files in directory D, and\n"
+          "                  reuse them when a table is unchanged\n");
+
+  fprintf(stderr,
+          " --check-overlap - list rows that overlap and give\n"
+          "                  different data, instead of writing ROMs\n"
+          " --emit-compiled - write each table in compiled form,\n"
+          "                  to file.ttc, instead of writing ROMs\n"
+          " --query[=FILE] - look up the addresses in FILE (or the\n"
+          "                  standard input) instead of writing ROMs\n");
+
+  fprintf(stderr,
+          " --simulate=FB  - run the state machine, with address\n"
+          "                  bits fed back as FB says (a=rom:b,...),\n"
+          "                  instead of writing ROMs\n"
+          " --vectors=FILE - take a run with the inputs in FILE\n"
+          " --start=HEX    - start each run in the state HEX\n"
+          " --trace[=N]    - show the first N steps of each run\n"
+          " --coverage     - report the addresses, states and lines\n"
+          "                  the runs reach\n"
+          " --reachable    - list the states no inputs can reach,\n"
+          "                  and the addresses no row covers\n");
+
+  fprintf(stderr,
+          " --stats[=FILE] - report time and memory used for each\n"
+          "                  file, and write them to FILE as JSON\n\n");
 
-          g_odcv);
+  fprintf(stderr,
+          "Report bugs to <admin@thayer.dartmouth.edu>\n\n");
 
 } /* end do_help() */
 
-void make_file_template(char *fname, char *tmpl, int tlen) {
-  static char *tag = "%d.hex";
+static int parse_formats(context *ctx, char *list) {
+  int fmt, ix;
+  size_t len;
+
+  ctx->nfmts = 0;
+
+  while (*list) {
+    len = strcspn(list, ",");
+
+    for (fmt = 1; fmt <= NUM_FMTS; fmt++)
+      if (strlen(fmt_name[fmt]) == len &&
+          strncmp(list, fmt_name[fmt], len) == 0)
+        break;
+
+    if (fmt > NUM_FMTS) return 0;
+
+    /* A format named twice is written once */
+    for (ix = 0; ix < ctx->nfmts && ctx->fmt[ix] != fmt; ix++)
+      ;
+    if (ix == ctx->nfmts) ctx->fmt[ctx->nfmts++] = fmt;
+
+    list += len;
+    if (*list == ',') ++list;
+  }
+
+  return ctx->nfmts > 0;
+
+} /* end parse_formats() */
+
+/*
+  With a single format, the template is used as it is, whatever its
+  extension.  With more, the extension of the template (if any) is
+  replaced by that of each format, so that their files are distinct.
+ */
+static char *format_template(context *ctx, int k, char *buf) {
+  char *tmpl = TEMPLATE(ctx), *ext = fmt_ext[ctx->fmt[k]], *dot;
+  size_t len;
+
+  if (ctx->nfmts == 1) return tmpl;
+
+  dot = strrchr(tmpl, '.');
+  len = (dot != NULL && strchr(dot, '/') == NULL) ? (size_t)(dot - tmpl)
+                                                  : strlen(tmpl);
+  if (len + strlen(ext) + 2 > MAXFILENAME) len = MAXFILENAME - strlen(ext) - 2;
+
+  memcpy(buf, tmpl, len);
+  buf[len] = '.';
+  strcpy(buf + len + 1, ext);
+
+  return buf;
+
+} /* end format_template() */
+
+void make_file_template(char *fname, char *tag, char *tmpl, int tlen) {
   int ix, pos = 0;
 
   if (fname[0] == '\0' || fname[0] == '.') {
@@ -507,89 +1695,879 @@ void make_file_template(char *fname, char *tmpl, int tlen) {
       tmpl[ix] = fname[ix];
   }
 
-  while (ix < tlen - 1) tmpl[ix++] = tag[pos++];
+  while (ix < tlen - 1 && tag[pos]) tmpl[ix++] = tag[pos++];
 
   tmpl[ix] = '\0';
 
 } /* end make_file_template() */
 
-int alloc_roms(byte ***romp, int nroms, char *config, int abits) {
-  unsigned int size = (1 << abits); /* ROM size */
-  int res = 1;                      /* innocent 'til proven guilty */
+#ifdef USE_THREADS
+static void *rom_worker(void *arg) {
+  write_rom(arg);
+  return NULL;
 
-  if ((*romp = calloc(nroms, sizeof(byte *))) == NULL) return 0;
+} /* end rom_worker() */
+#endif
 
-  while (*config) {
-    if (isdigit((int)*config)) {
-      int rnum = (*config - '0');
+/* Write all the ROMs of a table at once with tt_stream(), and close
+   their files.  Returns false if memory ran out, or a file could not
+   be written.
+ */
+static int stream_roms(context *ctx, tt_table *tp, romjob *job, int njobs) {
+  void *args[TT_MAXROMS * TT_MAXWORD];
+  int ix, jx, k, ok = 1;
+
+  /* Each format is streamed in a pass of its own */
+  for (k = 0; k < ctx->nfmts && ok; k++) {
+    for (ix = 0; ix < TT_MAXROMS * TT_MAXWORD; ix++) args[ix] = NULL;
+
+    for (ix = 0; ix < njobs; ix++) {
+      if (!ctx->opt.split)
+        args[job[ix].num] = job[ix].ofp[k][0];
+      else
+        for (jx = 0; jx < job[ix].nlanes; jx++)
+          args[job[ix].num * TT_MAXWORD + jx] = job[ix].ofp[k][jx];
+    }
 
-      /* If we haven't gotten this one already, allocate it */
-      if ((*romp)[rnum] == NULL) {
-        if (((*romp)[rnum] = calloc(size, sizeof(byte))) == NULL) {
-          fprintf(stderr, "Unable to allocate ROM #%d image\n", rnum);
-          res = 0;
-          break; /* out of the while() */
-        }
+    ok = tt_stream(tp, ctx->fmt[k], file_put, args);
+  }
+  if (!ok && tp->err != TT_OK)
+    fprintf(ctx->msg, "Insufficient memory to write ROM images\n");
+
+  for (ix = 0; ix < njobs; ix++) {
+    for (k = 0; k < ctx->nfmts; k++) {
+      for (jx = 0; jx < job[ix].nlanes; jx++) {
+        if (ctx->fs && ctx->fs->rom)
+          ctx->fs->rom[job[ix].num].bytes[k] += ftell(job[ix].ofp[k][jx]);
+        if (fclose(job[ix].ofp[k][jx]) != 0) ok = 0;
       }
     }
-
-    ++config;
   }
 
-  /* If an allocation failed, clean up any we already got */
-  if (res == 0) free_roms(*romp, nroms);
+  if (!ok && tp->err == TT_OK)
+    fprintf(ctx->msg, "Unable to write output files\n");
 
-  return res;
+  return ok;
+
+} /* end stream_roms() */
+
+#ifdef USE_MMAP
+/* Map the output file of ROM number 'num' as its image.  The lanes of
+   a location follow one another in the file, least significant first,
+   so words can be mapped only if that is the byte order wanted.
+ */
+static image *map_rom(void *arg, int num, int abits, int width, byte fill) {
+  context *ctx = arg;
+  char fname[MAXFILENAME];
+  image *img;
+
+  if (width > 1 && ctx->opt.enc.big) return NULL;
+
+  sprintf(fname, TEMPLATE(ctx), num);
+
+  if ((img = map_image(fname, abits, width, fill)) != NULL)
+    ctx->mapped[num] = 1;
 
-} /* end alloc_roms() */
+  return img;
 
-void free_roms(byte **romp, int nroms) {
+} /* end map_rom() */
+#endif
+
+/*
+  A ROM whose file cannot be mapped is given an ordinary image, and
+  written to its file as usual.
+ */
+static void map_roms(context *ctx) {
   int ix;
 
-  for (ix = 0; ix < nroms; ix++)
-    if (romp[ix]) {
-      free(romp[ix]);
-      romp[ix] = NULL;
-    }
+  for (ix = 0; ix < TT_MAXROMS; ix++) ctx->mapped[ix] = 0;
 
-} /* end free_roms() */
+#ifdef USE_MMAP
+  if (ctx->map) {
+    ctx->opt.new_rom = map_rom;
+    ctx->opt.rom_arg = ctx;
+  }
+#endif
+
+} /* end map_roms() */
 
-int dump_roms(byte **rom, int nroms, int abits, int fmt) {
+static void remove_mapped(context *ctx) {
   char fname[MAXFILENAME];
   int ix;
+
+  for (ix = 0; ix < TT_MAXROMS; ix++) {
+    if (ctx->mapped[ix]) {
+      sprintf(fname, TEMPLATE(ctx), ix);
+      remove(fname);
+      ctx->mapped[ix] = 0;
+    }
+  }
+
+} /* end remove_mapped() */
+
+/*
+  In a pipeline or a stream, all the output files are opened first.
+  In a pipeline, each ROM is then encoded and written by a thread of
+  its own, so that writing one file overlaps with encoding the others;
+  in a stream, they are all written together by tt_stream().
+  Otherwise they are written one at a time.  An image mapped from its
+  file has been written already, as it was filled in.
+ */
+int dump_roms(context *ctx, tt_table *tp) {
+  char fname[MAXFILENAME], tmpl[MAXFILENAME], label[LABELLEN];
+  romjob job[TT_MAXROMS];
+  image **rom = tp->rom;
+  int ix, k, nroms = tp->nroms, abits = tp->abits, njobs = 0, ok = 1;
+  int nlanes;
   FILE *ofp;
-  unsigned int romsize = (1 << abits);
+#ifdef USE_THREADS
+  pthread_t tid[TT_MAXROMS];
+  int nstarted;
+#endif
+
+  if (abits < (int)(sizeof(address) * CHAR_BIT))
+    fprintf(ctx->msg,
+            "%d ROM images to be written, %lu locations per image\n", nroms,
+            LOW_BITS(abits) + 1);
+  else
+    fprintf(ctx->msg,
+            "%d ROM images to be written, 2^%d locations per image\n", nroms,
+            abits);
+
+  if (ctx->cache && !cache_begin(ctx->cache))
+    fprintf(ctx->msg, "Unable to write to cache '%s'\n", ctx->cache_dir);
+
+  for (ix = 0; ix < nroms && ok; ix++) {
+    if (rom[ix] != NULL && rom[ix]->map != NULL) {
+      sprintf(fname, TEMPLATE(ctx), ix);
+      fprintf(ctx->msg, "Writing ROM %s to file '%s'\n",
+              rom_label(tp, ix, label), fname);
+
+      if (!sync_image(rom[ix])) {
+        fprintf(ctx->msg, "Unable to write output file '%s'\n", fname);
+        ok = 0;
+      } else if (ctx->fs && ctx->fs->rom) {
+        ctx->fs->rom[ix].bytes[0] =
+            ((double)(LOW_BITS(abits)) + 1) * tt_word_bytes(tp, ix);
+      }
+
+    } else if (rom[ix] != NULL) {
+      nlanes = NUM_LANES(ctx, tp, ix);
+
+      for (k = 0; k < ctx->nfmts * nlanes; k++) {
+        output_name(format_template(ctx, k / nlanes, tmpl), ix,
+                    (nlanes > 1) ? k % nlanes : -1, fname);
+
+        if ((ofp = fopen(fname, "w")) == NULL) {
+          fprintf(ctx->msg, "Unable to open output file '%s' for writing\n",
+                  fname);
+          while (--k >= 0) fclose(job[njobs].ofp[k / nlanes][k % nlanes]);
+          ok = 0;
+          break;
+        }
+
+        if (nlanes > 1)
+          fprintf(ctx->msg, "Writing ROM %s byte %d to file '%s'\n",
+                  rom_label(tp, ix, label), k % nlanes, fname);
+        else
+          fprintf(ctx->msg, "Writing ROM %s to file '%s'\n",
+                  rom_label(tp, ix, label), fname);
+        job[njobs].ofp[k / nlanes][k % nlanes] = ofp;
+      }
+      if (!ok) break;
+
+      job[njobs].ctx = ctx;
+      job[njobs].tp = tp;
+      job[njobs].num = ix;
+      job[njobs].nlanes = nlanes;
+
+      if (ctx->opt.pipeline || ctx->stream) {
+        ++njobs;
+      } else if (!write_rom(job)) {
+        fprintf(ctx->msg, "Unable to write ROM %s to its output files\n",
+                rom_label(tp, ix, label));
+        ok = 0;
+      }
+    }
+  }
+
+  if (ctx->stream) {
+    if (!stream_roms(ctx, tp, job, njobs)) return 0;
+    njobs = 0;
+  }
+
+  /* The ROMs whose files were opened are written in any case */
+#ifdef USE_THREADS
+  for (nstarted = 0; nstarted < njobs; nstarted++)
+    if (pthread_create(tid + nstarted, NULL, rom_worker, job + nstarted) != 0)
+      break;
+
+  /* Any that could not be given a thread are written here */
+  for (ix = nstarted; ix < njobs; ix++) write_rom(job + ix);
+
+  for (ix = 0; ix < nstarted; ix++) pthread_join(tid[ix], NULL);
+#endif
+
+  for (ix = 0; ix < njobs; ix++) {
+    if (!job[ix].ok) {
+      fprintf(ctx->msg, "Unable to write ROM %s to its output files\n",
+              rom_label(tp, job[ix].num, label));
+      ok = 0;
+    }
+  }
+
+  if (!ok) return 0;
+
+  /* An entry that lacks any of the files is abandoned */
+  if (ctx->cache) {
+    for (ix = 0; ix < nroms && ok; ix++) {
+      if (rom[ix] != NULL) {
+        sprintf(fname, TEMPLATE(ctx), ix);
+        ok = cache_add(ctx->cache, ix, fname);
+      }
+    }
 
-  fprintf(stderr, "%d ROM images to be written, %u bytes per image\n", nroms,
-          romsize);
+    if (ok)
+      ok = cache_end(ctx->cache);
+    else
+      cache_close(ctx->cache);
+
+    if (!ok)
+      fprintf(ctx->msg, "Unable to write to cache '%s'\n", ctx->cache_dir);
+  }
+
+  return 1;
+
+} /* end dump_roms() */
+
+static int write_rom(romjob *rj) {
+  double wall = wall_clock(), cpu = cpu_clock();
+  romstats *rs = NULL;
+  void *args[TT_MAXWORD];
+  int jx, k, ok = 1;
+
+  if (rj->ctx->fs && rj->ctx->fs->rom) rs = rj->ctx->fs->rom + rj->num;
+
+  for (k = 0; k < rj->ctx->nfmts; k++) {
+    if (rj->nlanes > 1) {
+      for (jx = 0; jx < rj->nlanes; jx++) args[jx] = rj->ofp[k][jx];
+      if (!tt_encode_lanes(rj->tp, rj->num, rj->ctx->fmt[k], file_put, args))
+        ok = 0;
+    } else if (!tt_encode(rj->tp, rj->num, rj->ctx->fmt[k], file_put,
+                          rj->ofp[k][0])) {
+      ok = 0;
+    }
+
+    for (jx = 0; jx < rj->nlanes; jx++) {
+      if (rs) rs->bytes[k] += ftell(rj->ofp[k][jx]);
+      if (fclose(rj->ofp[k][jx]) != 0) ok = 0;
+    }
+  }
+
+  if (rs) {
+    rs->wall = wall_clock() - wall;
+    rs->cpu = cpu_clock() - cpu;
+  }
+
+  return rj->ok = ok;
+
+} /* end write_rom() */
 
-  for (ix = 0; ix < nroms; ix++) {
-    if (rom[ix] != NULL) {
-      sprintf(fname, g_ftmpl, ix);
+static void output_name(char *tmpl, int num, int lane, char *fname) {
+  char *dot, ext[MAXFILENAME];
+  int len;
 
-      if ((ofp = fopen(fname, "w")) == NULL) {
-        fprintf(stderr, "Unable to open output file '%s' for writing\n", fname);
+  sprintf(fname, tmpl, num);
+  if (lane < 0) return;
+
+  dot = strrchr(fname, '.');
+  if (dot == NULL || strchr(dot, '/') != NULL) dot = fname + strlen(fname);
+
+  strcpy(ext, dot);
+  len = dot - fname;
+  if (len + (int)strlen(ext) + 3 > MAXFILENAME)
+    len = MAXFILENAME - strlen(ext) - 3;
+
+  sprintf(fname + len, "_%d%s", lane, ext);
+
+} /* end output_name() */
+
+/*
+  Each ROM is read back from the file it would have been written to,
+  on top of a blank image of the fill value (or of the value runs of
+  which are left out of the file, if there is one), and compared with
+  the bytes the ROM's image would be written as; or each byte lane of
+  it, if its words are split.  Returns false if any file could not be
+  read or does not match.
+ */
+int verify_roms(context *ctx, tt_table *tp) {
+  char fname[MAXFILENAME], label[LABELLEN];
+  image *img, *want;
+  address from, to;
+  int ix, jx, lane, nlanes, abits, width, line, err, ndiffs, ok = 1;
+  FILE *ifp;
+
+  for (ix = 0; ix < tp->nroms; ix++) {
+    if (tp->rom[ix] == NULL) continue;
+
+    nlanes = NUM_LANES(ctx, tp, ix);
+
+    for (jx = 0; jx < nlanes; jx++) {
+      lane = (nlanes > 1) ? jx : -1;
+      output_name(TEMPLATE(ctx), ix, lane, fname);
+
+      if ((ifp = fopen(fname, "r")) == NULL) {
+        fprintf(ctx->msg, "Unable to open file '%s' for reading\n", fname);
+        ok = 0;
+        continue;
+      }
+
+      if ((want = tt_byte_image(tp, ix, lane)) == NULL ||
+          (img = new_image(want->abits, 1,
+                           ctx->opt.enc.blank == NO_BLANK
+                               ? ctx->opt.fill
+                               : (byte)ctx->opt.enc.blank)) == NULL) {
+        fprintf(ctx->msg, "Insufficient memory to verify ROM %s\n",
+                rom_label(tp, ix, label));
+        free_image(want);
+        fclose(ifp);
         return 0;
       }
+      abits = want->abits;
+      width = ADDR_DIGITS(abits);
+
+      err = read_intel(img, ifp, &line);
+      fclose(ifp);
 
-      fprintf(stderr, "Writing ROM #%d to file '%s'\n", ix, fname);
-      switch (fmt) {
-        case BINARY_FMT:
-          dump_raw(rom[ix], romsize, ofp);
+      switch (err) {
+        case HEX_OK:
           break;
-        case TEXT_FMT:
-          dump_text(rom[ix], romsize, ofp);
+        case HEX_SYNTAX:
+          fprintf(ctx->msg, "File '%s' line %d: malformed record\n", fname,
+                  line);
+          break;
+        case HEX_CHECKSUM:
+          fprintf(ctx->msg, "File '%s' line %d: bad checksum\n", fname, line);
+          break;
+        case HEX_RANGE:
+          fprintf(ctx->msg, "File '%s' line %d: address out of range\n",
+                  fname, line);
+          break;
+        case HEX_NOEND:
+          fprintf(ctx->msg, "File '%s': missing end record\n", fname);
           break;
         default:
-          dump_intel(rom[ix], romsize, ofp);
+          fprintf(ctx->msg, "Insufficient memory to verify ROM %s\n",
+                  rom_label(tp, ix, label));
           break;
       }
-      fclose(ofp);
+
+      if (err != HEX_OK) {
+        free_image(want);
+        free_image(img);
+        ok = 0;
+        continue;
+      }
+
+      from = 0;
+      ndiffs = 0;
+      while (image_diff(want, 0, img, 0, &from, &to)) {
+        if (ndiffs++ == 0)
+          fprintf(ctx->msg, "ROM %s differs from file '%s':\n",
+                  rom_label(tp, ix, label), fname);
+
+        if (ndiffs <= MAXDIFFS) {
+          if (from == to)
+            fprintf(ctx->msg, "  %0*lX\n", width, from);
+          else
+            fprintf(ctx->msg, "  %0*lX-%0*lX\n", width, from, width, to);
+        }
+
+        if (to == LOW_BITS(abits)) break;
+        from = to + 1;
+      }
+
+      if (ndiffs > MAXDIFFS)
+        fprintf(ctx->msg, "  ... %d ranges in all\n", ndiffs);
+      else if (ndiffs == 0)
+        fprintf(ctx->msg, "ROM %s matches file '%s'\n",
+                rom_label(tp, ix, label), fname);
+
+      if (ndiffs > 0) ok = 0;
+
+      free_image(want);
+      free_image(img);
+    }
+  }
+
+  return ok;
+
+} /* end verify_roms() */
+
+/*
+  Each line of the query file holds an address, in hexadecimal, or as
+  a row of the table would give it: one '0', '1', or 'x' per address
+  bit.  For an address, the data word of each ROM and the line that
+  gives it are shown, in hexadecimal; for a pattern with don't-care
+  bits, the lines of all the rows that write to any address it covers
+  are listed, in order, so that the last one listed wins wherever they
+  overlap.
+  Comments and whitespace are ignored, as in a table.  Returns false
+  if the file could not be read, or had a line in it that is not an
+  address.
+ */
+static int answer_queries(context *ctx, tt_table *tp) {
+  char *buf = NULL, *pos, *endp;
+  size_t size = 0;
+  address base, mask;
+  int ix, line = 0, ok = 1;
+  int width = ADDR_DIGITS(tp->abits);
+  int *rows = NULL, nalloc = 0, nrows, got;
+  FILE *qfp;
+
+  if (strcmp(ctx->query, "-") == 0) {
+    qfp = stdin;
+  } else if ((qfp = fopen(ctx->query, "r")) == NULL) {
+    fprintf(ctx->msg, "Unable to open query file '%s' for reading\n",
+            ctx->query);
+    return 0;
+  }
+
+  while ((got = read_line(qfp, &buf, &size)) != 0) {
+    if (got < 0) {
+      fprintf(ctx->msg, "Insufficient memory to answer query\n");
+      ok = 0;
+      break;
+    }
+
+    ++line;
+    strip_comment(buf);
+    strip_whitespace(buf);
+    if (buf[0] == '\0') continue;
+
+    /* An address pattern, as a row gives it */
+    if ((int)strlen(buf) == tp->abits && valid_string(buf, "01xX")) {
+      compile_range(buf, tp->abits, &base, &mask);
+
+      /* Or an address in hexadecimal */
+    } else {
+      pos = buf;
+      if (pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X')) pos += 2;
+
+      mask = 0;
+      base = isxdigit((int)*pos) ? strtoul(pos, &endp, 16) : 0;
+
+      if (!isxdigit((int)*pos) || *endp != '\0' ||
+          base > LOW_BITS(tp->abits)) {
+        fprintf(ctx->msg, "Query line %d: invalid address '%s'\n", line, buf);
+        ok = 0;
+        continue;
+      }
+    }
+
+    if (mask == 0) {
+      print_lookup(tp, base, width);
+
+    } else {
+      if ((nrows = tt_list(tp, base, mask, &rows, &nalloc)) < 0) {
+        fprintf(ctx->msg, "Insufficient memory to answer query\n");
+        ok = 0;
+        break;
+      }
+
+      printf("%s:", buf);
+      for (ix = 0; ix < nrows; ix++)
+        printf("%s %d", ix ? "," : " lines", tp->rows.rows[rows[ix]].line);
+      printf(nrows ? "\n" : " no rows\n");
     }
   }
 
+  free(rows);
+  free(buf);
+  if (qfp != stdin) fclose(qfp);
+
+  return ok;
+
+} /* end answer_queries() */
+
+static void print_lookup(tt_table *tp, address addr, int width) {
+  byte data[TT_MAXROMS * TT_MAXWORD];
+  int ix, jx, off, wbytes, src = tt_lookup(tp, addr, data);
+  char *name;
+
+  /* Each word is shown most significant byte first */
+  printf("%0*lX:", width, addr);
+  for (ix = 0, off = 0; ix < tp->nroms; ix++, off += wbytes) {
+    if ((wbytes = tt_word_bytes(tp, ix)) == 0) continue;
+
+    if ((name = tt_rom_name(tp, ix)) != NULL)
+      printf(" %s=", name);
+    else
+      printf(" #%d=", ix);
+    for (jx = wbytes - 1; jx >= 0; jx--) printf("%02X", data[off + jx]);
+  }
+
+  if (src > 0)
+    printf(" (line %d)\n", src);
+  else
+    printf(" (no row)\n");
+
+} /* end print_lookup() */
+
+/* Read the vectors of a run from the named file, or the standard
+   input if it is "-".  Returns false if the file could not be read,
+   or had a line in it that is not an input vector.
+ */
+static int read_vectors(context *ctx, machine *mp, char *path, simrun *rp) {
+  char *buf = NULL;
+  size_t size = 0;
+  int got, line = 0, nalloc = 0, ok = 1;
+  vector *vec;
+  FILE *vfp;
+
+  if (strcmp(path, "-") == 0) {
+    vfp = stdin;
+  } else if ((vfp = fopen(path, "r")) == NULL) {
+    fprintf(ctx->msg, "Unable to open vector file '%s' for reading\n", path);
+    return 0;
+  }
+
+  while ((got = read_line(vfp, &buf, &size)) > 0) {
+    ++line;
+    strip_comment(buf);
+    strip_whitespace(buf);
+    if (buf[0] == '\0') continue;
+
+    if (rp->nvec == nalloc) {
+      nalloc = nalloc ? 2 * nalloc : MIN_VECTORS;
+      if ((vec = realloc(rp->vec, nalloc * sizeof(vector))) == NULL) {
+        got = -1;
+        break;
+      }
+      rp->vec = vec;
+    }
+
+    if (!parse_vector(mp, buf, rp->vec + rp->nvec)) {
+      fprintf(ctx->msg, "Vector file '%s' line %d: %d input bits expected\n",
+              path, line, mp->nin);
+      ok = 0;
+      break;
+    }
+    ++rp->nvec;
+  }
+
+  if (got < 0) {
+    fprintf(ctx->msg, "Insufficient memory to read vector file '%s'\n", path);
+    ok = 0;
+  }
+
+  free(buf);
+  if (vfp != stdin) fclose(vfp);
+
+  return ok;
+
+} /* end read_vectors() */
+
+/* Report the addresses and states the runs visited, given by the
+   set 'seen', and the lines of the table whose rows gave the ROMs'
+   words at those addresses; rows whose line is not one of the table's
+   are left out.  Returns false if memory could not be had.
+ */
+static int report_coverage(context *ctx, tt_table *tp, machine *mp,
+                           bitword *seen) {
+  byte data[TT_MAXROMS * TT_MAXWORD], *used;
+  size_t nw = SET_WORDS(mp->abits);
+  bitword *states;
+  double naddrs, nstates, total;
+  address addr, last = LOW_BITS(mp->abits), s;
+  int ix, line, nlines = 0, nused = 0, nmissed = 0;
+
+  states = calloc(nw, sizeof(bitword));
+  used = calloc(tp->line + 1, 1);
+  if (states == NULL || used == NULL) {
+    free(states);
+    free(used);
+    return 0;
+  }
+
+  for (addr = 0;; addr++) {
+    if (IN_SET(seen, addr)) {
+      ADD_SET(states, addr & mp->state);
+
+      line = tt_lookup(tp, addr, data);
+      if (line > 0 && line <= tp->line) used[line] = 1;
+    }
+
+    if (addr == last) break;
+  }
+
+  naddrs = count_set(seen, nw);
+  nstates = count_set(states, nw);
+  for (s = mp->state, total = 1; s != 0; s &= s - 1) total *= 2;
+
+  for (ix = 0; ix < tp->rows.nrows; ix++) {
+    line = tp->rows.rows[ix].line;
+    if (line < 1 || line > tp->line) continue;
+
+    ++nlines;
+    if (used[line]) ++nused;
+  }
+
+  fprintf(ctx->msg, "Coverage: %.0f of %.0f addresses, %.0f of %.0f states, "
+          "%d of %d lines\n", naddrs, (double)last + 1, nstates, total, nused,
+          nlines);
+
+  for (ix = 0; ix < tp->rows.nrows; ix++) {
+    line = tp->rows.rows[ix].line;
+    if (line < 1 || line > tp->line || used[line]) continue;
+
+    if (nmissed++ == 0) fprintf(ctx->msg, "Lines never used:");
+    if (nmissed <= MAXDIFFS) fprintf(ctx->msg, " %d", line);
+  }
+  if (nmissed > MAXDIFFS) fprintf(ctx->msg, " ... %d in all", nmissed);
+  if (nmissed > 0) fprintf(ctx->msg, "\n");
+
+  free(states);
+  free(used);
+
   return 1;
 
-} /* end dump_roms() */
+} /* end report_coverage() */
+
+/* A kind of cube being listed, and how many have been */
+typedef struct {
+  char *what;
+  int abits;
+  long count;
+} cubelist;
+
+/* List a cube as a row of the table would give its addresses */
+static void print_cube(void *arg, address base, address mask) {
+  cubelist *cl = arg;
+  int bit;
+
+  printf("%s ", cl->what);
+  for (bit = cl->abits - 1; bit >= 0; bit--)
+    putchar(((mask >> bit) & 1)   ? 'x'
+            : ((base >> bit) & 1) ? '1'
+                                  : '0');
+  putchar('\n');
+
+  ++cl->count;
+
+} /* end print_cube() */
+
+/* Find the states of a machine that cannot be reached from the start
+   state, and the addresses of the table that no row covers, and list
+   them as cubes.  Returns false if memory could not be had.
+ */
+static int report_reachable(context *ctx, tt_table *tp, machine *mp) {
+  size_t nw = SET_WORDS(mp->abits);
+  bitword *reached, *holes;
+  double wall, nstates = 1, nreached, nholes, live = 0;
+  address addr, last = LOW_BITS(mp->abits);
+  int ix, ok = 1;
+  cubelist cl;
+  long levels;
+
+  reached = calloc(nw, sizeof(bitword));
+  holes = calloc(nw, sizeof(bitword));
+  if (reached == NULL || holes == NULL) ok = 0;
+
+  if (ok) {
+    wall = wall_clock();
+    levels = reach_states(mp, ctx->start, ctx->opt.nthreads, reached);
+    wall = wall_clock() - wall;
+
+    if (levels < 0) ok = 0;
+  }
+
+  if (ok) {
+    for (ix = mp->nin; ix < mp->abits; ix++) nstates *= 2;
+    nreached = count_set(reached, nw);
+
+    fprintf(ctx->msg, "%.0f of %.0f states reachable from %0*lX, at most "
+            "%ld steps away (%.6fs)\n", nreached, nstates,
+            ADDR_DIGITS(tp->abits), ctx->start & mp->state, levels, wall);
+
+    cl.what = "unreachable";
+    cl.abits = mp->abits;
+    cl.count = 0;
+    ok = unreached_states(mp, reached, print_cube, &cl);
+  }
+
+  if (ok) {
+    fprintf(ctx->msg, "%.0f unreachable states, in %ld cubes\n",
+            nstates - nreached, cl.count);
+
+    cl.what = "uncovered";
+    cl.count = 0;
+    ok = find_holes(tp, holes) && find_cubes(holes, mp->abits, print_cube, &cl);
+  }
+
+  if (ok) {
+    nholes = count_set(holes, nw);
+
+    for (addr = 0;; addr++) {
+      if (IN_SET(holes, addr) && IN_SET(reached, addr & mp->state)) ++live;
+      if (addr == last) break;
+    }
+
+    fprintf(ctx->msg, "%.0f addresses covered by no row, in %ld cubes; "
+            "%.0f of them in reachable states\n", nholes, cl.count, live);
+  }
+
+  free(reached);
+  free(holes);
+
+  return ok;
+
+} /* end report_reachable() */
+
+/*
+  Each vector file is a run of its own.  The runs are taken together,
+  shared among the threads, and only then traced: each is stepped again
+  from its start, as far as was asked, and the ROMs' words at each
+  step are looked up as for a query.  A row's line is known only from
+  the rows, so they are indexed for tracing and coverage.  When only
+  the reachable states are wanted, no vectors are read unless given.
+ */
+static int simulate(context *ctx, tt_table *tp) {
+  char *stdin_vecs = "-";
+  char **vecs = ctx->nvecs ? ctx->vecs : &stdin_vecs;
+  int nvecs = ctx->nvecs ? ctx->nvecs : ctx->reach ? 0 : 1;
+  int ix, width = ADDR_DIGITS(tp->abits), ok = 1;
+  simrun *runs = NULL;
+  address *addrs = NULL;
+  bitword *seen = NULL;
+  double wall = 0, steps = 0, longest = 0;
+  long step, nsteps, depth;
+  machine m;
+
+  switch (make_machine(tp, ctx->sim, &m)) {
+    case SIM_OK:
+      break;
+    case SIM_BADSPEC:
+      fprintf(ctx->msg, "Feedback '%s' does not fit the table\n", ctx->sim);
+      free_machine(&m);
+      return 0;
+    default:
+      fprintf(ctx->msg, "Insufficient memory to simulate\n");
+      free_machine(&m);
+      return 0;
+  }
+
+  if ((nvecs > 0 && (runs = calloc(nvecs, sizeof(simrun))) == NULL) ||
+      (ctx->coverage &&
+       (seen = calloc(SET_WORDS(m.abits), sizeof(bitword))) == NULL) ||
+      ((ctx->trace || ctx->coverage) && tt_index(tp) != TT_OK)) {
+    fprintf(ctx->msg, "Insufficient memory to simulate\n");
+    ok = 0;
+  }
+
+  for (ix = 0; ix < nvecs && ok; ix++) {
+    runs[ix].start = ctx->start & m.state;
+    ok = read_vectors(ctx, &m, vecs[ix], runs + ix);
+  }
+
+  if (ok && nvecs > 0) {
+    fprintf(ctx->msg, "Simulating %d run%s, with %d state bits and %d "
+            "input bits\n", nvecs, (nvecs == 1) ? "" : "s",
+            m.abits - m.nin, m.nin);
+
+    wall = wall_clock();
+    if (!run_machine(&m, runs, nvecs, ctx->opt.nthreads, seen)) {
+      fprintf(ctx->msg, "Insufficient memory to simulate\n");
+      ok = 0;
+    }
+    wall = wall_clock() - wall;
+  }
+
+  for (ix = 0; ix < nvecs && ok; ix++) {
+    fprintf(ctx->msg, "Run %d ('%s'): %.0f steps, ending in state %0*lX\n",
+            ix + 1, vecs[ix], runs[ix].steps, width, runs[ix].end);
+    steps += runs[ix].steps;
+    if (runs[ix].steps > longest) longest = runs[ix].steps;
+  }
+
+  if (ok && nvecs > 0) {
+    fprintf(ctx->msg, "%.0f steps in %.6fs", steps, wall);
+    if (wall > 0)
+      fprintf(ctx->msg, ", %.1f million steps/s", steps / wall / 1e6);
+    fprintf(ctx->msg, "\n");
+  }
+
+  /* No run is traced further than the longest one goes */
+  depth = (longest < ctx->trace) ? (long)longest : ctx->trace;
+  if (ok && depth > 0 && (addrs = malloc(depth * sizeof(address))) == NULL) {
+    fprintf(ctx->msg, "Insufficient memory to simulate\n");
+    ok = 0;
+  }
+
+  for (ix = 0; ix < nvecs && ok && addrs != NULL; ix++) {
+    nsteps = trace_run(&m, runs + ix, addrs, depth);
+
+    for (step = 0; step < nsteps; step++) {
+      printf("run %d step %ld: ", ix + 1, step);
+      print_lookup(tp, addrs[step], width);
+    }
+  }
+
+  if (ok && seen && !report_coverage(ctx, tp, &m, seen)) {
+    fprintf(ctx->msg, "Insufficient memory to report coverage\n");
+    ok = 0;
+  }
+
+  if (ok && ctx->reach && !report_reachable(ctx, tp, &m)) {
+    fprintf(ctx->msg, "Insufficient memory to find reachable states\n");
+    ok = 0;
+  }
+
+  for (ix = 0; runs != NULL && ix < nvecs; ix++) free(runs[ix].vec);
+  free(runs);
+  free(seen);
+  free(addrs);
+  free_machine(&m);
+
+  return ok;
+
+} /* end simulate() */
+
+static char *rom_label(tt_table *tp, int num, char *buf) {
+  char *name = tt_rom_name(tp, num);
+
+  if (name == NULL)
+    sprintf(buf, "#%d", num);
+  else if (strlen(name) < LABELLEN - 8)
+    sprintf(buf, "#%d (%s)", num, name);
+  else
+    sprintf(buf, "#%d (%.*s...)", num, LABELLEN - 16, name);
+
+  return buf;
+
+} /* end rom_label() */
+
+/*
+  The addresses the two rows share are shown as a row of the table
+  would give them, with 'x' for each don't-care bit.
+ */
+static void report_overlap(void *arg, rowset *rs, int first, int second,
+                           address base, address mask) {
+  overlap *op = arg;
+  char cube[TT_MAXBITS + 1];
+  int ix, bit;
+
+  for (ix = 0, bit = op->abits - 1; bit >= 0; ix++, bit--) {
+    if ((mask >> bit) & 1)
+      cube[ix] = 'x';
+    else
+      cube[ix] = '0' + (int)((base >> bit) & 1);
+  }
+  cube[ix] = '\0';
+
+  fprintf(op->msg, "Lines %d and %d overlap with different data at %s\n",
+          rs->rows[first].line, rs->rows[second].line, cube);
+
+} /* end report_overlap() */
 
 /* Here there be dragons */
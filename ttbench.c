@@ -0,0 +1,231 @@
+/*
+  ttbench.c
+
+  Time the phases of compiling truth tables with tt2rom version 2.
+
+  Syntax:
+    ttbench [options] <file> ...
+
+  Options:
+    --repeat=N    time each phase N times, keeping the best (default 3)
+    --threads=N   use N threads to fill in each ROM image
+    --interleave  build all ROMs of a table in one image
+    --out=FILE    also write the results to FILE, as tab-separated
+                  columns: file, phase, wall and CPU seconds, count,
+                  unit, and count per second of wall time
+
+  Each file is read into memory once, and then for each repetition is
+  parsed into rows (parse), written into ROM images (expand), and
+  encoded in each output format (raw, text, intel).  Encoded output is
+  counted and thrown away, so that no time is spent writing files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtt2rom.h"
+#include "text.h"
+#include "timer.h"
+
+#define NPHASES 5 /* parse, expand, and three encoders */
+
+/* The best time for one phase, and how much work it did */
+typedef struct {
+  char *name;   /* phase name                 */
+  char *unit;   /* what 'count' counts        */
+  double wall;  /* best elapsed time, seconds */
+  double cpu;   /* processor time of the best */
+  double count; /* rows, addresses, or bytes  */
+} phase;
+
+/* Time all the phases for one file */
+static int bench_file(char *path, tt_options *opt, int repeat, FILE *out);
+
+/* A sink that counts the bytes it is given, and discards them */
+static int count_sink(void *arg, char *buf, size_t len);
+
+/* Keep the time of a phase, if it is the first or the best so far */
+static void keep_best(phase *ph, int first, double wall, double cpu);
+
+int main(int argc, char *argv[]) {
+  tt_options opt;
+  optbuf ob;
+  FILE *out = NULL;
+  char *name, *value, *endp;
+  int ix, repeat = 3, res = 0;
+
+  tt_defaults(&opt);
+
+  while (argc >= 2 && parse_option(argv[1], &ob, &name, &value)) {
+    if (strcmp(name, "repeat") == 0 && value != NULL) {
+      repeat = strtol(value, &endp, 10);
+      if (*endp != '\0' || repeat < 1) {
+        fprintf(stderr, "Repeat count must be at least 1\n");
+        return 1;
+      }
+    } else if (strcmp(name, "threads") == 0 && value != NULL) {
+      opt.nthreads = strtol(value, &endp, 10);
+      if (*endp != '\0' || opt.nthreads < 1) {
+        fprintf(stderr, "Number of threads must be at least 1\n");
+        return 1;
+      }
+    } else if (strcmp(name, "interleave") == 0) {
+      opt.interleave = 1;
+    } else if (strcmp(name, "out") == 0 && value != NULL) {
+      if ((out = fopen(strchr(argv[1], '=') + 1, "w")) == NULL) {
+        fprintf(stderr, "Unable to open output file '%s' for writing\n",
+                strchr(argv[1], '=') + 1);
+        return 1;
+      }
+      fprintf(out, "file\tphase\twall\tcpu\tcount\tunit\trate\n");
+    } else {
+      fprintf(stderr, "Unrecognized option: '%s'\n", name);
+      return 1;
+    }
+
+    --argc;
+    ++argv;
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: ttbench [options] <file> ...\n");
+    return 1;
+  }
+
+  for (ix = 1; ix < argc; ix++)
+    if (!bench_file(argv[ix], &opt, repeat, out)) res = 1;
+
+  if (out != NULL) fclose(out);
+
+  return res;
+}
+
+static int bench_file(char *path, tt_options *opt, int repeat, FILE *out) {
+  static char *fmt_name[] = {"raw", "text", "intel"};
+  static int fmt_code[] = {TT_RAW, TT_TEXT, TT_INTEL};
+  phase ph[NPHASES];
+  char *text, msg[TT_MSGLEN];
+  long len;
+  FILE *ifp;
+  tt_table tab;
+  double t0, c0;
+  int ix, jx, rep;
+
+  /* Read the whole table in, so that file I/O is not timed */
+  if ((ifp = fopen(path, "rb")) == NULL) {
+    fprintf(stderr, "Unable to open file '%s' for reading\n", path);
+    return 0;
+  }
+  fseek(ifp, 0, SEEK_END);
+  len = ftell(ifp);
+  rewind(ifp);
+
+  if (len < 0 || (text = malloc(len + 1)) == NULL) {
+    fprintf(stderr, "Insufficient memory to read file '%s'\n", path);
+    fclose(ifp);
+    return 0;
+  }
+  len = fread(text, 1, len, ifp);
+  fclose(ifp);
+
+  memset(ph, 0, sizeof(ph));
+  ph[0].name = "parse";
+  ph[0].unit = "rows";
+  ph[1].name = "expand";
+  ph[1].unit = "addresses";
+  for (ix = 0; ix < 3; ix++) {
+    ph[ix + 2].name = fmt_name[ix];
+    ph[ix + 2].unit = "bytes";
+  }
+
+  for (rep = 0; rep < repeat; rep++) {
+    t0 = wall_clock();
+    c0 = cpu_clock();
+    if (tt_parse(&tab, opt, text, len) != TT_OK) {
+      tt_message(&tab, msg);
+      fprintf(stderr, "%s: %s\n", path, msg);
+      tt_free(&tab);
+      free(text);
+      return 0;
+    }
+    keep_best(&ph[0], rep == 0, wall_clock() - t0, cpu_clock() - c0);
+    ph[0].count = tab.rows.nrows;
+
+    /* Each row writes 2^k addresses, for k don't-care bits */
+    ph[1].count = 0;
+    for (ix = 0; ix < tab.rows.nrows; ix++) {
+      address mask = tab.rows.rows[ix].mask;
+      double n = 1;
+
+      for (; mask != 0; mask &= mask - 1) n *= 2;
+      ph[1].count += n;
+    }
+
+    t0 = wall_clock();
+    c0 = cpu_clock();
+    if (tt_end(&tab) != TT_OK) {
+      fprintf(stderr, "%s: insufficient memory\n", path);
+      tt_free(&tab);
+      free(text);
+      return 0;
+    }
+    keep_best(&ph[1], rep == 0, wall_clock() - t0, cpu_clock() - c0);
+
+    for (jx = 0; jx < 3; jx++) {
+      ph[jx + 2].count = 0;
+
+      t0 = wall_clock();
+      c0 = cpu_clock();
+      for (ix = 0; ix < tab.nroms; ix++)
+        if (tab.rom[ix] != NULL)
+          tt_encode(&tab, ix, fmt_code[jx], count_sink, &ph[jx + 2].count);
+      keep_best(&ph[jx + 2], rep == 0, wall_clock() - t0, cpu_clock() - c0);
+    }
+
+    if (rep + 1 < repeat) tt_free(&tab);
+  }
+
+  printf("%s: %.0f rows, %d address bits, %d ROMs, best of %d\n", path,
+         ph[0].count, tab.abits, tab.nroms, repeat);
+  tt_free(&tab);
+
+  for (ix = 0; ix < NPHASES; ix++) {
+    double rate = (ph[ix].wall > 0) ? ph[ix].count / ph[ix].wall : 0;
+
+    printf("  %-7s %9.4fs wall %9.4fs cpu  %12.0f %-9s", ph[ix].name,
+           ph[ix].wall, ph[ix].cpu, ph[ix].count, ph[ix].unit);
+    if (ix == 0)
+      printf(" %10.3g rows/s %8.2f MB/s in\n", rate,
+             (ph[ix].wall > 0) ? len / ph[ix].wall / 1e6 : 0);
+    else if (ix == 1)
+      printf(" %10.3g addresses/s\n", rate);
+    else
+      printf(" %8.2f MB/s out\n", rate / 1e6);
+
+    if (out != NULL)
+      fprintf(out, "%s\t%s\t%.6f\t%.6f\t%.0f\t%s\t%.6g\n", path, ph[ix].name,
+              ph[ix].wall, ph[ix].cpu, ph[ix].count, ph[ix].unit, rate);
+  }
+
+  free(text);
+
+  return 1;
+
+} /* end bench_file() */
+
+static int count_sink(void *arg, char *buf, size_t len) {
+  *(double *)arg += len;
+  return 1;
+
+} /* end count_sink() */
+
+static void keep_best(phase *ph, int first, double wall, double cpu) {
+  if (first || wall < ph->wall) {
+    ph->wall = wall;
+    ph->cpu = cpu;
+  }
+
+} /* end keep_best() */
+
+/* Here there be dragons */
@@ -0,0 +1,140 @@
+/*
+  ttgen.c
+
+  Generate random truth tables for benchmarking tt2rom version 2.
+
+  Syntax:
+    ttgen [options] > table.tt
+
+  Options:
+    --rows=N   number of data lines                   (default 1000)
+    --abits=N  number of address (state) bits         (default 16)
+    --roms=N   number of ROMs, 1-64                   (default 1)
+    --width=N  output bits per ROM, 1-64              (default 8)
+    --dc=P     percent of address bits that are 'x'   (default 10)
+    --odc=P    percent of output bits that are '-'    (default 0)
+    --seed=S   seed for the random number generator   (default 1)
+
+  The same options always give the same table, on any platform, since
+  a generator of our own is used instead of rand().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtt2rom.h"
+#include "text.h"
+
+/* Parse a numeric option value, exiting on junk or out of range */
+static long get_number(char *name, char *value, long lo, long hi);
+
+/* Next number from a 32-bit xorshift generator */
+static unsigned long next_random(unsigned long *state);
+
+/* True with probability 'pct' percent */
+#define CHANCE(S, pct) ((long)(next_random(S) % 100) < (pct))
+
+int main(int argc, char *argv[]) {
+  long rows = 1000, abits = 16, nroms = 1, width = 8, dc = 10, odc = 0;
+  unsigned long seed = 1;
+  optbuf opt;
+  char *name, *value;
+  long ix, jx, kx;
+
+  while (argc >= 2 && parse_option(argv[1], &opt, &name, &value)) {
+    if (strcmp(name, "rows") == 0)
+      rows = get_number(name, value, 1, 100000000L);
+    else if (strcmp(name, "abits") == 0)
+      abits = get_number(name, value, 1, TT_MAXBITS);
+    else if (strcmp(name, "roms") == 0)
+      nroms = get_number(name, value, 1, TT_MAXROMS);
+    else if (strcmp(name, "width") == 0)
+      width = get_number(name, value, 1, TT_MAXWORD * 8);
+    else if (strcmp(name, "dc") == 0)
+      dc = get_number(name, value, 0, 100);
+    else if (strcmp(name, "odc") == 0)
+      odc = get_number(name, value, 0, 100);
+    else if (strcmp(name, "seed") == 0)
+      seed = get_number(name, value, 1, 0x7FFFFFFFL);
+    else {
+      fprintf(stderr, "Unrecognized option: '%s'\n", name);
+      return 1;
+    }
+
+    --argc;
+    ++argv;
+  }
+
+  if (argc > 1) {
+    fprintf(stderr, "Usage: ttgen [options] > table.tt\n");
+    return 1;
+  }
+
+  printf("# ttgen --rows=%ld --abits=%ld --roms=%ld --width=%ld --dc=%ld "
+         "--odc=%ld --seed=%lu\n\n",
+         rows, abits, nroms, width, dc, odc, seed);
+
+  /* Configuration line; ROMs past 9 need a bracketed group */
+  for (ix = 0; ix < abits; ix++) putchar('A');
+  for (jx = 0; jx < nroms; jx++) {
+    if (jx > 9) {
+      printf(" [%ld:%ld]", jx, width);
+      continue;
+    }
+
+    putchar(' ');
+    for (kx = 0; kx < width; kx++) putchar('0' + (int)jx);
+  }
+  putchar('\n');
+
+  for (ix = 0; ix < rows; ix++) {
+    for (jx = 0; jx < abits; jx++)
+      putchar(CHANCE(&seed, dc) ? 'x' : '0' + (int)(next_random(&seed) & 1));
+
+    for (jx = 0; jx < nroms; jx++) {
+      putchar(' ');
+      for (kx = 0; kx < width; kx++)
+        putchar(CHANCE(&seed, odc) ? '-' : '0' + (int)(next_random(&seed) & 1));
+    }
+    putchar('\n');
+  }
+
+  return 0;
+}
+
+static long get_number(char *name, char *value, long lo, long hi) {
+  char *endp;
+  long val;
+
+  if (value == NULL || value[0] == '\0') {
+    fprintf(stderr, "Value of '%s' must be specified\n", name);
+    exit(1);
+  }
+
+  val = strtol(value, &endp, 10);
+  if (*endp != '\0') {
+    fprintf(stderr, "Unrecognized junk in option value: '%s'\n", endp);
+    exit(1);
+  } else if (val < lo || val > hi) {
+    fprintf(stderr, "Value of '%s' out of range: %ld-%ld expected\n", name, lo,
+            hi);
+    exit(1);
+  }
+
+  return val;
+
+} /* end get_number() */
+
+static unsigned long next_random(unsigned long *state) {
+  unsigned long x = *state;
+
+  x ^= (x << 13) & 0xFFFFFFFFUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xFFFFFFFFUL;
+
+  return *state = x;
+
+} /* end next_random() */
+
+/* Here there be dragons */